@@ -0,0 +1,179 @@
+/* See LICENSE file for copyright and license details.
+ *
+ * Microbenchmark of the icon pixel kernels in drw.c, built with `make bench`.
+ * drw.c is included so its static kernels can be timed one by one. Each
+ * kernel is checked against the scalar code before it is timed. */
+#include "drw.c"
+
+#include <time.h>
+
+static const unsigned int sizes[] = { 32, 64, 128, 256, 512 };
+
+static double now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* xorshift32, the pixels only need to cover every alpha */
+static uint32_t rnd(void) {
+	static uint32_t x = 2463534242u;
+	x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+	return x;
+}
+
+static void fill(long* src, size_t n) {
+	for (size_t i = 0; i < n; i++)
+		src[i] = (long)rnd();
+}
+
+static size_t pack_scalar(char* buf, size_t n) {
+	unsigned int v;
+	long l;
+	for (size_t i = 0; i < n; i++) {
+		memcpy(&l, buf + i * sizeof(long), sizeof(l));
+		v = prealpha(l);
+		memcpy(buf + i * sizeof(v), &v, sizeof(v));
+	}
+	return n;
+}
+
+/* Run kernel over a fresh copy of src reps times, minus the copy itself,
+ * in microseconds per call. */
+static double timepack(size_t (*kernel)(char*, size_t), const long* src, long* buf, size_t n, unsigned int reps) {
+	double t0, copy, total;
+
+	t0 = now();
+	for (unsigned int r = 0; r < reps; r++)
+		memcpy(buf, src, n * sizeof(long));
+	copy = now() - t0;
+	t0 = now();
+	for (unsigned int r = 0; r < reps; r++) {
+		memcpy(buf, src, n * sizeof(long));
+		kernel((char*)buf, n);
+	}
+	total = now() - t0;
+	return (total - copy) * 1e6 / reps;
+}
+
+static void checkpack(const char* name, size_t (*kernel)(char*, size_t)) {
+	long src[300], a[300], b[300];
+	unsigned int v;
+	size_t n, i;
+
+	fill(src, LENGTH(src));
+	for (n = 0; n <= LENGTH(src); n++) {
+		memcpy(a, src, n * sizeof(long));
+		memcpy(b, src, n * sizeof(long));
+		pack_scalar((char*)a, n);
+		/* the tail is left to the scalar loop, as in drw_pack_argb() */
+		for (i = kernel((char*)b, n); i < n; i++) {
+			v = prealpha(src[i]);
+			memcpy((char*)b + i * sizeof(v), &v, sizeof(v));
+		}
+		if (memcmp(a, b, n * 4))
+			die("bench: %s differs from scalar at %zu pixels", name, n);
+	}
+}
+
+static void benchpack(void) {
+	const unsigned int maxn = 512 * 512;
+	long* src = ecalloc(maxn, sizeof(long));
+	long* buf = ecalloc(maxn, sizeof(long));
+	unsigned int reps;
+
+	fill(src, maxn);
+	#ifdef SIMD_X86
+		bool avx2 = __builtin_cpu_supports("avx2");
+		checkpack("sse2", pack_sse2);
+		if (avx2)
+			checkpack("avx2", pack_avx2);
+	#endif /* SIMD_X86 */
+	printf("drw_pack_argb, us per call\n%-10s %9s %9s %9s\n", "size", "scalar", "sse2", "avx2");
+	for (int s = 0; s < LENGTH(sizes); s++) {
+		size_t n = (size_t)sizes[s] * sizes[s];
+		reps = MAX(20, (1u << 24) / n);
+		printf("%4ux%-5u %9.1f", sizes[s], sizes[s], timepack(pack_scalar, src, buf, n, reps));
+		#ifdef SIMD_X86
+			printf(" %9.1f", timepack(pack_sse2, src, buf, n, reps));
+			if (avx2)
+				printf(" %9.1f", timepack(pack_avx2, src, buf, n, reps));
+			else
+				printf(" %9s", "-");
+		#else
+			printf(" %9s %9s", "-", "-");
+		#endif /* SIMD_X86 */
+		putchar('\n');
+	}
+	free(src);
+	free(buf);
+}
+
+/* drw_scale_argb() with the plain C rows of halve() only */
+static void scale_scalar(unsigned int* px, unsigned int* w, unsigned int* h, unsigned int dstw, unsigned int dsth) {
+	unsigned int x, y;
+
+	while (*w > (dstw << 1u) && *h > (dsth << 1u)) {
+		for (y = 0; y < *h / 2; y++)
+			for (x = 0; x < *w / 2; x++)
+				px[y * (*w / 2) + x] = avg4(px[2 * y * *w + 2 * x], px[2 * y * *w + 2 * x + 1],
+					px[(2 * y + 1) * *w + 2 * x], px[(2 * y + 1) * *w + 2 * x + 1]);
+		*w /= 2;
+		*h /= 2;
+	}
+}
+
+static double timescale(void (*scale)(unsigned int*, unsigned int*, unsigned int*, unsigned int, unsigned int),
+	const unsigned int* src, unsigned int* buf, unsigned int size, unsigned int dst, unsigned int reps) {
+	size_t bytes = (size_t)size * size * 4;
+	unsigned int w, h;
+	double t0, copy, total;
+
+	t0 = now();
+	for (unsigned int r = 0; r < reps; r++)
+		memcpy(buf, src, bytes);
+	copy = now() - t0;
+	t0 = now();
+	for (unsigned int r = 0; r < reps; r++) {
+		memcpy(buf, src, bytes);
+		w = h = size;
+		scale(buf, &w, &h, dst, dst);
+	}
+	total = now() - t0;
+	return (total - copy) * 1e6 / reps;
+}
+
+/* square sources down to a bar icon, the case the mip chain is for */
+static void benchscale(void) {
+	const unsigned int dst = 20, maxn = 512 * 512;
+	unsigned int* src = ecalloc(maxn, sizeof(unsigned int));
+	unsigned int* a = ecalloc(maxn, sizeof(unsigned int));
+	unsigned int* b = ecalloc(maxn, sizeof(unsigned int));
+	unsigned int w, h, bw, bh, reps;
+
+	for (unsigned int i = 0; i < maxn; i++)
+		src[i] = rnd();
+	printf("\ndrw_scale_argb to %ux%u, us per call\n%-10s %9s %9s\n", dst, dst, "size", "scalar", "simd");
+	for (int s = 1; s < LENGTH(sizes); s++) {
+		memcpy(a, src, (size_t)sizes[s] * sizes[s] * 4);
+		memcpy(b, src, (size_t)sizes[s] * sizes[s] * 4);
+		w = h = bw = bh = sizes[s];
+		scale_scalar(a, &w, &h, dst, dst);
+		drw_scale_argb(b, &bw, &bh, dst, dst);
+		if (w != bw || h != bh || memcmp(a, b, (size_t)w * h * 4))
+			die("bench: drw_scale_argb differs from scalar at %ux%u", sizes[s], sizes[s]);
+		reps = MAX(20, (1u << 24) / (sizes[s] * sizes[s]));
+		printf("%4ux%-5u %9.1f %9.1f\n", sizes[s], sizes[s],
+			timescale(scale_scalar, src, a, sizes[s], dst, reps),
+			timescale(drw_scale_argb, src, b, sizes[s], dst, reps));
+	}
+	free(src);
+	free(a);
+	free(b);
+}
+
+int main(void) {
+	benchpack();
+	benchscale();
+	return 0;
+}
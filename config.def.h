@@ -5,6 +5,7 @@ static const bool focusonhover       = 0;    /* 0 means focus only on click, oth
 static const bool focusonwheel       = 0;    /* if focusonhover is 0, whether to count scrolling as click */
 static const bool focusmononhover    = 1;    /* 0 means focus only on click, otherwise */
 static const bool focusmononwheel    = 0;    /* if focusmononhover is 0, whether to count scrolling as click */
+static const bool asyncclickfocus    = 1;    /* with XInput2, focus follows the click instead of holding it until focused */
 static const bool resizemousewarp    = 0;    /* if 1 warp pointer to corner when resizing */
 
 /* layout */
@@ -23,6 +24,11 @@ static const int resizehints         = 1;    /* 1 means respect size hints in ti
 static const char* ignorehintsmatch[] = { "steam", "Steam" };
 static const char* ignorehintscontains[] = { "steam_app_", "osu", "VSC", "Chrom", "iscord", "manfm" };
 
+/* misbehaving clients, past the allowance a client's requests of one kind
+ * (configure, property, activate, focus) are merged and applied later */
+static const unsigned int rateburst  = 32;   /* events let through at once */
+static const unsigned int ratepersec = 16;   /* allowance refilled per second */
+
 static const Layout layouts[] = {
 	/* symbol, arrange function */
 	{ "󰕰",     ltgrid    }, /* grid (default) */
@@ -37,6 +43,8 @@ static const char broken[] = "broken";       /* text for windows with no title *
 static const bool showbar  = true;           /* false means no bar */
 static const bool topbar   = true;           /* false means bottom bar */
 #define ICONSIZE (bh * 0.6)                  /* icon size */
+static const unsigned long iconbudget = 4 << 20; /* bytes of icon pictures kept in the X server */
+static const unsigned int titlemax = 32;   /* titles drawn before scrolling the rest, 0 for no limit */
 static const char* tags[] = { "1", "2", "3", "4", "5", "6", "7", "8", "9" };
 
 /* font */
@@ -224,7 +232,8 @@ static const Key keys[] = {
 };
 
 /* button definitions */
-/* click can be ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle, ClkClientWin, or ClkRootWin */
+/* click can be ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle, ClkWinCounter,
+ * ClkClientWin, or ClkRootWin */
 static const Button buttons[] = {
 	/* click                event mask          button          function           argument */
 	{ ClkLtSymbol,          0,                  Button1,        cmdinclayout,      { .i =  1          } },
@@ -234,6 +243,7 @@ static const Button buttons[] = {
 	{ ClkWinTitle,          0,                  Button2,        cmdtogglefloating, { 0                } },
 	{ ClkWinTitle,          ShiftMask,          Button3,        cmdkillclient,     { 0                } },
 	{ ClkWinTitle,          0,                  Button3,        cmdfocusclient,    { 0                } },
+	{ ClkWinCounter,        0,                  Button1,        cmdfocusclient,    { 0                } },
 	{ ClkStatusText,        0,                  Button1,        cmdspawn,          { .v = termcmd     } },
 	{ ClkStatusText,        0,                  Button2,        cmdspawn,          { .v = termcmd     } },
 	{ ClkStatusText,        0,                  Button3,        cmdspawn,          { .v = termcmd     } },
@@ -12,10 +12,21 @@ NODRW = 0
 LIBS += -I/usr/X11R6/lib -lX11
 INCS += -L/usr/X11R6/include
 
+# XCB, for pipelined requests
+LIBS += -lX11-xcb -lxcb
+
 # Xinerama
 LIBS += -lXinerama
 FLAG += -DXINERAMA
 
+# Xrandr 1.5, monitors tracked by output, Xinerama is the fallback
+LIBS += -lXrandr
+FLAG += -DXRANDR
+
+# XInput 2.1, raw button presses for asyncclickfocus
+LIBS += -lXi
+FLAG += -DXINPUT
+
 ifeq ($(strip $(NODRW)), 0)
 
 # freetype
@@ -25,8 +36,11 @@ INCS += -I/usr/include/freetype2
 # LIBS += ${X11INC}/freetype2
 # incs += ${PREFIX}/man
 
-# Imlib2
-LIBS += -lXrender -lImlib2
+# Xrender, MIT-SHM
+LIBS += -lXrender -lXext -lxcb-shm
+
+# icon worker
+LIBS += -lpthread
 
 else
 
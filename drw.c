@@ -30,17 +30,26 @@ Clr* drw_scm_create(const char* const clrnames[], const unsigned int alphas[], s
 #else
 
 #include <string.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
 
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xft/Xft.h>
+#include <X11/extensions/XShm.h>
+#include <xcb/shm.h>
 
-#include <Imlib2.h>
+#if defined(__x86_64__) && (defined(__GNUC__) || defined(__clang__))
+	#define SIMD_X86
+	#include <immintrin.h>
+#endif /* __x86_64__ */
 
 #include "util.h"
 #include "drw.h"
 
 #define UTF_INVALID 0xFFFD
 #define UTF_SIZ 4
+#define SHMRING (256 * 1024) /* uploads between round trips, see drw_picture_create_resized() */
 
 static const unsigned char utfbyte[UTF_SIZ + 1] = { 0x80,     0,    0xC0,  0xE0,   0xF0     };
 static const unsigned char utfmask[UTF_SIZ + 1] = { 0xC0,     0x80, 0xE0,  0xF0,   0xF8     };
@@ -85,49 +94,124 @@ static size_t utf8decode(const char* c, long int* u, size_t clen) {
 	return len;
 }
 
-Drw* drw_create(Display* dpy, int screen, Window root, unsigned int w, unsigned int h, Visual* visual, unsigned int depth, Colormap cmap) {
+static void shmfree(Drw* drw) {
+	if (!drw->shmsize)
+		return;
+	XShmDetach(drw->dpy, &drw->shm);
+	XSync(drw->dpy, false);
+	shmdt(drw->shm.shmaddr);
+	drw->shmsize = drw->shmoff = 0;
+}
+
+/* Replace the shared segment with one of at least size bytes, keeping the
+ * old one if that fails. The attach is checked on its own cookie, the Xlib
+ * error handler is process wide and shared with the other threads. */
+static bool shmalloc(Drw* drw, size_t size) {
+	xcb_connection_t* xcon = XGetXCBConnection(drw->dpy);
+	xcb_generic_error_t* err;
+	XShmSegmentInfo shm = { 0 };
+
+	size = (size + 0xFFFF) & ~(size_t)0xFFFF;
+	if ((shm.shmid = shmget(IPC_PRIVATE, size, IPC_CREAT | 0600)) == -1)
+		return false;
+	shm.shmaddr = shmat(shm.shmid, NULL, 0);
+	/* destroyed as soon as both sides have detached */
+	shmctl(shm.shmid, IPC_RMID, NULL);
+	if (shm.shmaddr == (char*)-1)
+		return false;
+	shm.readOnly = true;
+	shm.shmseg = xcb_generate_id(xcon);
+
+	err = xcb_request_check(xcon, xcb_shm_attach_checked(xcon, shm.shmseg, shm.shmid, true));
+	if (err) {
+		/* the server cannot see our memory, e.g. it runs on another host */
+		if (err->error_code == BadAccess)
+			drw->useshm = false;
+		free(err);
+		shmdt(shm.shmaddr);
+		return false;
+	}
+	shmfree(drw);
+	drw->shm = shm;
+	drw->shmsize = size;
+	drw->shmoff = 0;
+	return true;
+}
+
+Drw* drw_create(Display* dpy, int screen, Window root, Visual* visual, unsigned int depth, Colormap cmap) {
 	Drw* drw = ecalloc(1, sizeof(Drw));
+	Pixmap pm;
 
 	drw->dpy = dpy;
 	drw->screen = screen;
 	drw->root = root;
-	drw->w = w;
-	drw->h = h;
 	drw->visual = visual;
 	drw->depth = depth;
 	drw->cmap = cmap;
-	drw->visual = visual;
-	drw->depth = depth;
-	drw->cmap = cmap;
-	drw->drawable = XCreatePixmap(dpy, root, w, h, depth);
-	drw->gc = XCreateGC(dpy, drw->drawable, 0, NULL);
-	drw->picture = XRenderCreatePicture(drw->dpy, drw->drawable, XRenderFindVisualFormat(drw->dpy, drw->visual), 0, NULL);
+	/* a GC may be used with any drawable of the same root and depth, so a
+	 * throwaway pixmap is enough to create it */
+	pm = XCreatePixmap(dpy, root, 1, 1, depth);
+	drw->gc = XCreateGC(dpy, pm, 0, NULL);
+	XFreePixmap(dpy, pm);
 	XSetLineAttributes(dpy, drw->gc, 1, LineSolid, CapButt, JoinMiter);
+	drw->useshm = XShmQueryExtension(dpy);
 
 	return drw;
 }
 
-void drw_resize(Drw* drw, unsigned int w, unsigned int h) {
-	if (!drw)
-		return;
-	drw->w = w;
-	drw->h = h;
-	if (drw->picture)
-		XRenderFreePicture(drw->dpy, drw->picture);
-	if (drw->drawable)
-		XFreePixmap(drw->dpy, drw->drawable);
-	drw->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, drw->depth);
-	drw->picture = XRenderCreatePicture(drw->dpy, drw->drawable, XRenderFindVisualFormat(drw->dpy, drw->visual), 0, NULL);
-}
-
 void drw_free(Drw* drw) {
-	XRenderFreePicture(drw->dpy, drw->picture);
-	XFreePixmap(drw->dpy, drw->drawable);
+	shmfree(drw);
+	free(drw->rects);
+	free(drw->comps);
+	free(drw->glyphs);
 	XFreeGC(drw->dpy, drw->gc);
 	drw_fontset_free(drw->fonts);
 	free(drw);
 }
 
+Srf* drw_surface_create(Drw* drw, unsigned int w, unsigned int h) {
+	Srf* srf;
+
+	if (!drw)
+		return NULL;
+	srf = ecalloc(1, sizeof(Srf));
+	drw_surface_resize(drw, srf, w, h);
+	return srf;
+}
+
+void drw_surface_resize(Drw* drw, Srf* srf, unsigned int w, unsigned int h) {
+	if (!drw || !srf)
+		return;
+	/* pixmaps cannot be empty */
+	w = MAX(w, 1);
+	h = MAX(h, 1);
+	if (srf->drawable && srf->w == w && srf->h == h)
+		return;
+	srf->w = w;
+	srf->h = h;
+	if (srf->picture)
+		XRenderFreePicture(drw->dpy, srf->picture);
+	if (srf->drawable)
+		XFreePixmap(drw->dpy, srf->drawable);
+	srf->drawable = XCreatePixmap(drw->dpy, drw->root, w, h, drw->depth);
+	srf->picture = XRenderCreatePicture(drw->dpy, srf->drawable, XRenderFindVisualFormat(drw->dpy, drw->visual), 0, NULL);
+}
+
+void drw_surface_free(Drw* drw, Srf* srf) {
+	if (!drw || !srf)
+		return;
+	if (drw->surface == srf)
+		drw->surface = NULL;
+	XRenderFreePicture(drw->dpy, srf->picture);
+	XFreePixmap(drw->dpy, srf->drawable);
+	free(srf);
+}
+
+void drw_setsurface(Drw* drw, Srf* srf) {
+	if (drw)
+		drw->surface = srf;
+}
+
 /* This function is an implementation detail. Library users should use
  * drw_fontset_create instead.
  */
@@ -228,76 +312,296 @@ void drw_setscheme(Drw* drw, Clr* scm) {
 		drw->scheme = scm;
 }
 
+static unsigned int prealpha(unsigned int p) {
+	unsigned char a = p >> 24u;
+	unsigned int rb = (a * (p & 0xFF00FFu)) >> 8u;
+	unsigned int g = (a * (p & 0x00FF00u)) >> 8u;
+	return (rb & 0xFF00FFu) | (g & 0x00FF00u) | (a << 24u);
+}
+
+#ifdef SIMD_X86
+	/* The kernels below return how many pixels they handled, the rest is
+	 * left to the scalar loop. Each loads a whole block before storing it,
+	 * which keeps the in place narrowing from long to 32 bits safe. */
+
+	static size_t pack_sse2(char* buf, size_t n) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i amask = _mm_set1_epi32(0xff000000);
+		__m128i a, b, p, lo, hi, alo, ahi;
+		size_t i;
+
+		for (i = 0; i + 4 <= n; i += 4) {
+			a = _mm_loadu_si128((const __m128i*)(buf + i * 8));
+			b = _mm_loadu_si128((const __m128i*)(buf + i * 8 + 16));
+			/* keep the low half of every long */
+			a = _mm_shuffle_epi32(a, _MM_SHUFFLE(3, 1, 2, 0));
+			b = _mm_shuffle_epi32(b, _MM_SHUFFLE(3, 1, 2, 0));
+			p = _mm_unpacklo_epi64(a, b);
+			/* (a * c) >> 8 per channel in 16 bit lanes, as prealpha() */
+			lo = _mm_unpacklo_epi8(p, zero);
+			hi = _mm_unpackhi_epi8(p, zero);
+			alo = _mm_shufflehi_epi16(_mm_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			ahi = _mm_shufflehi_epi16(_mm_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			lo = _mm_srli_epi16(_mm_mullo_epi16(lo, alo), 8);
+			hi = _mm_srli_epi16(_mm_mullo_epi16(hi, ahi), 8);
+			lo = _mm_packus_epi16(lo, hi);
+			p = _mm_or_si128(_mm_andnot_si128(amask, lo), _mm_and_si128(amask, p));
+			_mm_storeu_si128((__m128i*)(buf + i * 4), p);
+		}
+		return i;
+	}
+
+	__attribute__((target("avx2")))
+	static size_t pack_avx2(char* buf, size_t n) {
+		const __m256i zero = _mm256_setzero_si256();
+		const __m256i amask = _mm256_set1_epi32(0xff000000);
+		const __m256i low = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		__m256i a, b, p, lo, hi, alo, ahi;
+		size_t i;
+
+		for (i = 0; i + 8 <= n; i += 8) {
+			a = _mm256_loadu_si256((const __m256i*)(buf + i * 8));
+			b = _mm256_loadu_si256((const __m256i*)(buf + i * 8 + 32));
+			a = _mm256_permutevar8x32_epi32(a, low);
+			b = _mm256_permutevar8x32_epi32(b, low);
+			p = _mm256_permute2x128_si256(a, b, 0x20);
+			lo = _mm256_unpacklo_epi8(p, zero);
+			hi = _mm256_unpackhi_epi8(p, zero);
+			alo = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(lo, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			ahi = _mm256_shufflehi_epi16(_mm256_shufflelo_epi16(hi, _MM_SHUFFLE(3, 3, 3, 3)), _MM_SHUFFLE(3, 3, 3, 3));
+			lo = _mm256_srli_epi16(_mm256_mullo_epi16(lo, alo), 8);
+			hi = _mm256_srli_epi16(_mm256_mullo_epi16(hi, ahi), 8);
+			lo = _mm256_packus_epi16(lo, hi);
+			p = _mm256_or_si256(_mm256_andnot_si256(amask, lo), _mm256_and_si256(amask, p));
+			_mm256_storeu_si256((__m256i*)(buf + i * 4), p);
+		}
+		return i;
+	}
+#endif /* SIMD_X86 */
+
+/* Narrow n _NET_WM_ICON longs in place to premultiplied 32-bit ARGB, the
+ * result starts at the same address. */
+void drw_pack_argb(long* pixels, size_t n) {
+	char* buf = (char*)pixels;
+	unsigned int v;
+	size_t i = 0;
+	long l;
+
+	#ifdef SIMD_X86
+		static size_t (*kernel)(char* buf, size_t n);
+		if (!kernel)
+			kernel = __builtin_cpu_supports("avx2") ? pack_avx2 : pack_sse2;
+		if (sizeof(long) == 8)
+			i = kernel(buf, n);
+	#endif /* SIMD_X86 */
+	/* memcpy keeps the aliasing of long and int stores well defined */
+	for (; i < n; i++) {
+		memcpy(&l, buf + i * sizeof(long), sizeof(l));
+		v = prealpha(l);
+		memcpy(buf + i * sizeof(v), &v, sizeof(v));
+	}
+}
+
+/* per channel (a + b + 1) >> 1 and (a + b + c + d + 2) >> 2 of packed ARGB */
+static unsigned int avg2(unsigned int a, unsigned int b) {
+	unsigned int rb = ((a & 0xFF00FFu) + (b & 0xFF00FFu) + 0x10001u) >> 1u;
+	unsigned int ag = (((a >> 8u) & 0xFF00FFu) + ((b >> 8u) & 0xFF00FFu) + 0x10001u) >> 1u;
+	return (rb & 0xFF00FFu) | ((ag & 0xFF00FFu) << 8u);
+}
+
+static unsigned int avg4(unsigned int a, unsigned int b, unsigned int c, unsigned int d) {
+	unsigned int rb = ((a & 0xFF00FFu) + (b & 0xFF00FFu) + (c & 0xFF00FFu) + (d & 0xFF00FFu) + 0x20002u) >> 2u;
+	unsigned int ag = (((a >> 8u) & 0xFF00FFu) + ((b >> 8u) & 0xFF00FFu)
+		+ ((c >> 8u) & 0xFF00FFu) + ((d >> 8u) & 0xFF00FFu) + 0x20002u) >> 2u;
+	return (rb & 0xFF00FFu) | ((ag & 0xFF00FFu) << 8u);
+}
+
+#ifdef SIMD_X86
+	/* one output row of a 2x2 box filter, same rounding as avg4() */
+	static unsigned int halve_sse2(const unsigned int* r0, const unsigned int* r1, unsigned int* out, unsigned int w) {
+		const __m128i zero = _mm_setzero_si128();
+		const __m128i two = _mm_set1_epi16(2);
+		__m128i a, b, lo, hi;
+		unsigned int x;
+
+		for (x = 0; x + 2 <= w; x += 2) {
+			a = _mm_loadu_si128((const __m128i*)(r0 + 2 * x));
+			b = _mm_loadu_si128((const __m128i*)(r1 + 2 * x));
+			lo = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero));
+			hi = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero));
+			lo = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+			lo = _mm_srli_epi16(_mm_add_epi16(lo, two), 2);
+			_mm_storel_epi64((__m128i*)(out + x), _mm_packus_epi16(lo, lo));
+		}
+		return x;
+	}
+#endif /* SIMD_X86 */
+
+/* Halve an image in place along the requested axes by averaging pixel
+ * pairs, a trailing odd row or column is dropped. */
+static void halve(unsigned int* px, unsigned int* w, unsigned int* h, bool hx, bool hy) {
+	const unsigned int sw = *w;
+	const unsigned int nw = hx ? sw / 2 : sw, nh = hy ? *h / 2 : *h;
+	const unsigned int* r0, * r1;
+	unsigned int* out;
+	unsigned int x, y;
+
+	for (y = 0; y < nh; y++) {
+		r0 = px + (hy ? 2 * y : y) * sw;
+		r1 = hy ? r0 + sw : r0;
+		out = px + y * nw;
+		x = 0;
+		if (hx && hy) {
+			#ifdef SIMD_X86
+				x = halve_sse2(r0, r1, out, nw);
+			#endif /* SIMD_X86 */
+			for (; x < nw; x++)
+				out[x] = avg4(r0[2 * x], r0[2 * x + 1], r1[2 * x], r1[2 * x + 1]);
+		} else if (hx) {
+			for (; x < nw; x++)
+				out[x] = avg2(r0[2 * x], r0[2 * x + 1]);
+		} else {
+			for (; x < nw; x++)
+				out[x] = avg2(r0[x], r1[x]);
+		}
+	}
+	*w = nw;
+	*h = nh;
+}
+
+void drw_scale_argb(unsigned int* pixels, unsigned int* w, unsigned int* h, unsigned int dstw, unsigned int dsth) {
+	/* bilinear filtering skips source pixels beyond a factor of two, box
+	 * filter down a mip chain until it does not */
+	while (*w > (dstw << 1u) || *h > (dsth << 1u))
+		halve(pixels, w, h, *w > (dstw << 1u), *h > (dsth << 1u));
+}
+
+/* src holds premultiplied ARGB and is used as scratch space */
 Picture drw_picture_create_resized(Drw* drw, char* src, unsigned int srcw, unsigned int srch, unsigned int dstw, unsigned int dsth) {
 	Pixmap pm;
 	Picture pic;
 	GC gc;
-
-	if (srcw <= (dstw << 1u) && srch <= (dsth << 1u)) {
-		XImage img = {
-			srcw, srch, 0, ZPixmap, src,
-			ImageByteOrder(drw->dpy), BitmapUnit(drw->dpy), BitmapBitOrder(drw->dpy), 32,
-			32, 0, 32,
-			0, 0, 0,
-			NULL, {0}
-		};
-		XInitImage(&img);
-
-		pm = XCreatePixmap(drw->dpy, drw->root, srcw, srch, 32);
-		gc = XCreateGC(drw->dpy, pm, 0, NULL);
+	size_t size;
+
+	drw_scale_argb((unsigned int*)src, &srcw, &srch, dstw, dsth);
+	size = (size_t)srcw * srch * 4;
+
+	XImage img = {
+		srcw, srch, 0, ZPixmap, src,
+		ImageByteOrder(drw->dpy), BitmapUnit(drw->dpy), BitmapBitOrder(drw->dpy), 32,
+		32, 0, 32,
+		0, 0, 0,
+		NULL, {0}
+	};
+	XInitImage(&img);
+
+	pm = XCreatePixmap(drw->dpy, drw->root, srcw, srch, 32);
+	gc = XCreateGC(drw->dpy, pm, 0, NULL);
+	/* a segment that cannot be had only costs this upload the copy */
+	if (drw->useshm && (size <= drw->shmsize || shmalloc(drw, MAX(size, SHMRING)))) {
+		/* uploads follow each other through the segment, only when it
+		 * wraps around may the server still be reading the one it
+		 * overwrites, and only if no reply since has said otherwise */
+		if (drw->shmoff + size > drw->shmsize) {
+			if ((long)(LastKnownRequestProcessed(drw->dpy) - drw->shmseq) < 0)
+				XSync(drw->dpy, false);
+			drw->shmoff = 0;
+		}
+		img.data = drw->shm.shmaddr + drw->shmoff;
+		img.obdata = (char*)&drw->shm;
+		memcpy(img.data, src, size);
+		drw->shmseq = NextRequest(drw->dpy);
+		XShmPutImage(drw->dpy, pm, gc, &img, 0, 0, 0, 0, srcw, srch, false);
+		drw->shmoff += (size + 63) & ~(size_t)63;
+	} else {
 		XPutImage(drw->dpy, pm, gc, &img, 0, 0, 0, 0, srcw, srch);
-		XFreeGC(drw->dpy, gc);
+	}
+	XFreeGC(drw->dpy, gc);
 
-		pic = XRenderCreatePicture(drw->dpy, pm, XRenderFindStandardFormat(drw->dpy, PictStandardARGB32), 0, NULL);
-		XFreePixmap(drw->dpy, pm);
+	pic = XRenderCreatePicture(drw->dpy, pm, XRenderFindStandardFormat(drw->dpy, PictStandardARGB32), 0, NULL);
+	XFreePixmap(drw->dpy, pm);
 
-		XRenderSetPictureFilter(drw->dpy, pic, FilterBilinear, NULL, 0);
-		XTransform xf;
-		xf.matrix[0][0] = (srcw << 16u) / dstw; xf.matrix[0][1] = 0; xf.matrix[0][2] = 0;
-		xf.matrix[1][0] = 0; xf.matrix[1][1] = (srch << 16u) / dsth; xf.matrix[1][2] = 0;
-		xf.matrix[2][0] = 0; xf.matrix[2][1] = 0; xf.matrix[2][2] = 65536;
-		XRenderSetPictureTransform(drw->dpy, pic, &xf);
-	} else {
-		Imlib_Image origin = imlib_create_image_using_data(srcw, srch, (DATA32 *)src);
-		if (!origin) return None;
-		imlib_context_set_image(origin);
-		imlib_image_set_has_alpha(true);
-		Imlib_Image scaled = imlib_create_cropped_scaled_image(0, 0, srcw, srch, dstw, dsth);
-		imlib_free_image_and_decache();
-		if (!scaled) return None;
-		imlib_context_set_image(scaled);
-		imlib_image_set_has_alpha(true);
-
-		XImage img = {
-			dstw, dsth, 0, ZPixmap, (char* )imlib_image_get_data_for_reading_only(),
-			ImageByteOrder(drw->dpy), BitmapUnit(drw->dpy), BitmapBitOrder(drw->dpy), 32,
-			32, 0, 32,
-			0, 0, 0,
-			NULL, {0}
-		};
-		XInitImage(&img);
-
-		pm = XCreatePixmap(drw->dpy, drw->root, dstw, dsth, 32);
-		gc = XCreateGC(drw->dpy, pm, 0, NULL);
-		XPutImage(drw->dpy, pm, gc, &img, 0, 0, 0, 0, dstw, dsth);
-		imlib_free_image_and_decache();
-		XFreeGC(drw->dpy, gc);
-
-		pic = XRenderCreatePicture(drw->dpy, pm, XRenderFindStandardFormat(drw->dpy, PictStandardARGB32), 0, NULL);
-		XFreePixmap(drw->dpy, pm);
-	}
+	XRenderSetPictureFilter(drw->dpy, pic, FilterBilinear, NULL, 0);
+	XTransform xf;
+	xf.matrix[0][0] = (srcw << 16u) / dstw; xf.matrix[0][1] = 0; xf.matrix[0][2] = 0;
+	xf.matrix[1][0] = 0; xf.matrix[1][1] = (srch << 16u) / dsth; xf.matrix[1][2] = 0;
+	xf.matrix[2][0] = 0; xf.matrix[2][1] = 0; xf.matrix[2][2] = 65536;
+	XRenderSetPictureTransform(drw->dpy, pic, &xf);
 
 	return pic;
 }
 
+static void putrects(Drw* drw, unsigned long pixel, bool fore, bool filled, XRectangle* r, unsigned int n) {
+	if (!drw->recording) {
+		XSetForeground(drw->dpy, drw->gc, pixel);
+		if (filled)
+			XFillRectangles(drw->dpy, drw->surface->drawable, drw->gc, r, n);
+		else
+			XDrawRectangles(drw->dpy, drw->surface->drawable, drw->gc, r, n);
+		return;
+	}
+	if (drw->nrects + n > drw->rectcap) {
+		drw->rectcap = MAX(drw->rectcap * 2, drw->nrects + n);
+		drw->rects = erealloc(drw->rects, drw->rectcap * sizeof(DrwRect));
+	}
+	while (n--)
+		drw->rects[drw->nrects++] = (DrwRect){ pixel, fore, filled, *r++ };
+}
+
+static void putcomp(Drw* drw, int op, Picture src, int sx, int sy, int x, int y, unsigned int w, unsigned int h) {
+	if (!drw->recording) {
+		XRenderComposite(drw->dpy, op, src, None, drw->surface->picture, sx, sy, 0, 0, x, y, w, h);
+		return;
+	}
+	if (drw->ncomps == drw->compcap) {
+		drw->compcap = MAX(drw->compcap * 2, 16);
+		drw->comps = erealloc(drw->comps, drw->compcap * sizeof(DrwComp));
+	}
+	drw->comps[drw->ncomps++] = (DrwComp){ op, src, sx, sy, x, y, w, h };
+}
+
+static void putstring(Drw* drw, XftDraw** d, const XftColor* color, Fnt* font, int x, int y, const char* text, int len) {
+	XGlyphInfo ext;
+	FT_UInt glyph;
+	long int u;
+	size_t n;
+
+	if (!drw->recording) {
+		if (!*d)
+			*d = XftDrawCreate(drw->dpy, drw->surface->drawable, drw->visual, drw->cmap);
+		XftDrawStringUtf8(*d, color, font->xfont, x, y, (XftChar8 *)text, len);
+		return;
+	}
+	/* resolve glyphs now, so text of any colour and font can be replayed
+	 * with one request per colour */
+	while (len > 0 && (n = utf8decode(text, &u, len))) {
+		if (drw->nglyphs == drw->glyphcap) {
+			drw->glyphcap = MAX(drw->glyphcap * 2, 64);
+			drw->glyphs = erealloc(drw->glyphs, drw->glyphcap * sizeof(DrwGlyph));
+		}
+		glyph = XftCharIndex(drw->dpy, font->xfont, u);
+		drw->glyphs[drw->nglyphs++] = (DrwGlyph){ color, { font->xfont, glyph, x, y } };
+		XftGlyphExtents(drw->dpy, font->xfont, &glyph, 1, &ext);
+		x += ext.xOff;
+		text += n;
+		len -= n;
+	}
+}
+
 void drw_rect(Drw* drw, int x, int y, unsigned int w, unsigned int h, bool filled, bool invert) {
-	if (!drw || !drw->scheme)
+	XRectangle r = { x, y, filled ? w : w - 1, filled ? h : h - 1 };
+
+	if (!drw || !drw->scheme || !drw->surface)
+		return;
+	putrects(drw, drw->scheme[invert ? ColBg : ColFg].pixel, !invert, filled, &r, 1);
+}
+
+/* Batched drw_rect(), outlines follow XDrawRectangles() and therefore cover
+ * (width + 1) x (height + 1) pixels. */
+void drw_rects(Drw* drw, XRectangle* r, unsigned int n, bool filled, bool invert) {
+	if (!drw || !drw->scheme || !drw->surface || !n)
 		return;
-	XSetForeground(drw->dpy, drw->gc, invert ? drw->scheme[ColBg].pixel : drw->scheme[ColFg].pixel);
-	if (filled)
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-	else
-		XDrawRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w - 1, h - 1);
+	putrects(drw, drw->scheme[invert ? ColBg : ColFg].pixel, !invert, filled, r, n);
 }
 
 int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char* text, bool invert) {
@@ -316,15 +620,14 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 	/* keep track of a couple codepoints for which we have no match. */
 	static unsigned int nomatches[64], ellipsis_width;
 
-	if (!drw || (render && (!drw->scheme || !w)) || !text || !drw->fonts)
+	if (!drw || (render && (!drw->scheme || !drw->surface || !w)) || !text || !drw->fonts)
 		return 0;
 
 	if (!render) {
 		w = invert ? 1 : ~0;
 	} else {
-		XSetForeground(drw->dpy, drw->gc, drw->scheme[invert ? ColFg : ColBg].pixel);
-		XFillRectangle(drw->dpy, drw->drawable, drw->gc, x, y, w, h);
-		d = XftDrawCreate(drw->dpy, drw->drawable, drw->visual, drw->cmap);
+		XRectangle r = { x, y, w, h };
+		putrects(drw, drw->scheme[invert ? ColFg : ColBg].pixel, false, true, &r, 1);
 		x += lpad;
 		w -= lpad;
 	}
@@ -378,7 +681,7 @@ int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned in
 		if (utf8strlen) {
 			if (render) {
 				ty = y + (h - usedfont->h) / 2 + usedfont->xfont->ascent;
-				XftDrawStringUtf8(d, &drw->scheme[invert ? ColBg : ColFg], usedfont->xfont, x, ty, (XftChar8 *)utf8str, utf8strlen);
+				putstring(drw, &d, &drw->scheme[invert ? ColBg : ColFg], usedfont, x, ty, utf8str, utf8strlen);
 			}
 			x += ew;
 			w -= ew;
@@ -446,15 +749,116 @@ no_match:
 }
 
 void drw_pic(Drw* drw, int x, int y, unsigned int w, unsigned int h, Picture pic) {
+	if (!drw || !drw->surface)
+		return;
+	putcomp(drw, PictOpOver, pic, 0, 0, x, y, w, h);
+}
+
+/* Replace an area of the current surface with one from src */
+void drw_copy(Drw* drw, Srf* src, int sx, int sy, int x, int y, unsigned int w, unsigned int h) {
+	if (!drw || !drw->surface || !src)
+		return;
+	putcomp(drw, PictOpSrc, src->picture, sx, sy, x, y, w, h);
+}
+
+static int rectcmp(const void* a, const void* b) {
+	const DrwRect* ra = a;
+	const DrwRect* rb = b;
+
+	if (ra->fore != rb->fore)
+		return ra->fore - rb->fore;
+	if (ra->filled != rb->filled)
+		return ra->filled - rb->filled;
+	return (ra->pixel > rb->pixel) - (ra->pixel < rb->pixel);
+}
+
+static int compcmp(const void* a, const void* b) {
+	const DrwComp* ca = a;
+	const DrwComp* cb = b;
+
+	if (ca->src != cb->src)
+		return (ca->src > cb->src) - (ca->src < cb->src);
+	if (ca->op != cb->op)
+		return ca->op - cb->op;
+	if (ca->sy != cb->sy)
+		return ca->sy - cb->sy;
+	return ca->sx - cb->sx;
+}
+
+static int glyphcmp(const void* a, const void* b) {
+	const DrwGlyph* ga = a;
+	const DrwGlyph* gb = b;
+
+	return (ga->color > gb->color) - (ga->color < gb->color);
+}
+
+/* replay recorded rectangles [*i, end of fore) as one request per colour and kind */
+static void flushrects(Drw* drw, unsigned int* i, bool fore) {
+	XRectangle r[128];
+	unsigned int n, j;
+
+	for (j = *i; j < drw->nrects && drw->rects[j].fore == fore; *i = j) {
+		const DrwRect* first = &drw->rects[j];
+		for (n = 0; j < drw->nrects && n < LENGTH(r) && !rectcmp(first, &drw->rects[j]); j++)
+			r[n++] = drw->rects[j].r;
+		putrects(drw, first->pixel, fore, first->filled, r, n);
+	}
+}
+
+void drw_record(Drw* drw) {
 	if (!drw)
 		return;
-	XRenderComposite(drw->dpy, PictOpOver, pic, None, drw->picture, 0, 0, 0, 0, x, y, w, h);
+	drw->recording = true;
+	drw->nrects = drw->ncomps = drw->nglyphs = 0;
+}
+
+void drw_flush(Drw* drw) {
+	XftGlyphFontSpec specs[256];
+	XftDraw* d;
+	DrwComp* c;
+	unsigned int i, j, n, r = 0;
+
+	if (!drw || !drw->recording)
+		return;
+	drw->recording = false;
+	if (!drw->surface)
+		return;
+
+	qsort(drw->rects, drw->nrects, sizeof(DrwRect), rectcmp);
+	flushrects(drw, &r, false);
+
+	/* merge copies of neighbouring source areas to neighbouring places */
+	qsort(drw->comps, drw->ncomps, sizeof(DrwComp), compcmp);
+	for (i = 0; i < drw->ncomps; i = j) {
+		c = &drw->comps[i];
+		for (j = i + 1; j < drw->ncomps; j++) {
+			const DrwComp* next = &drw->comps[j];
+			if (next->src != c->src || next->op != c->op || next->sy != c->sy || next->y != c->y
+				|| next->h != c->h || next->sx != c->sx + (int)c->w || next->x != c->x + (int)c->w)
+				break;
+			c->w += next->w;
+		}
+		putcomp(drw, c->op, c->src, c->sx, c->sy, c->x, c->y, c->w, c->h);
+	}
+
+	if (drw->nglyphs) {
+		qsort(drw->glyphs, drw->nglyphs, sizeof(DrwGlyph), glyphcmp);
+		d = XftDrawCreate(drw->dpy, drw->surface->drawable, drw->visual, drw->cmap);
+		for (i = 0; i < drw->nglyphs; i = j) {
+			for (n = 0, j = i; j < drw->nglyphs && n < LENGTH(specs) && drw->glyphs[j].color == drw->glyphs[i].color; j++)
+				specs[n++] = drw->glyphs[j].spec;
+			XftDrawGlyphFontSpec(d, drw->glyphs[i].color, specs, n);
+		}
+		XftDrawDestroy(d);
+	}
+
+	flushrects(drw, &r, true);
 }
 
 void drw_map(Drw* drw, Window win, int x, int y, unsigned int w, unsigned int h) {
-	if (!drw)
+	if (!drw || !drw->surface)
 		return;
-	XCopyArea(drw->dpy, drw->drawable, win, drw->gc, x, y, w, h, x, y);
+	XCopyArea(drw->dpy, drw->surface->drawable, win, drw->gc, x, y, w, h, x, y);
 	XSync(drw->dpy, False);
 }
 
@@ -25,27 +25,66 @@ struct Fnt {
 	struct Fnt* next;
 };
 
+typedef struct Srf Srf;
+struct Srf {
+	unsigned int w, h;
+	Drawable drawable;
+	Picture picture;
+};
+
+/* display list entries, see drw_record() */
+typedef struct {
+	unsigned long pixel;
+	bool fore, filled;
+	XRectangle r;
+} DrwRect;
+
+typedef struct {
+	int op;
+	Picture src;
+	int sx, sy, x, y;
+	unsigned int w, h;
+} DrwComp;
+
+typedef struct {
+	const XftColor* color;
+	XftGlyphFontSpec spec;
+} DrwGlyph;
+
 typedef struct Drw Drw;
 struct Drw {
-	unsigned int w, h;
 	Display* dpy;
 	int screen;
 	Window root;
 	Visual* visual;
 	unsigned int depth;
 	Colormap cmap;
-	Drawable drawable;
-	Picture picture;
+	Srf* surface; /* current drawing target */
 	GC gc;
 	Clr* scheme;
 	Fnt* fonts;
+	XShmSegmentInfo shm; /* a ring of image uploads */
+	size_t shmsize, shmoff; /* the next upload goes at shmoff */
+	unsigned long shmseq; /* request of the last upload */
+	bool useshm;
+	bool recording;
+	DrwRect* rects;
+	DrwComp* comps;
+	DrwGlyph* glyphs;
+	unsigned int nrects, ncomps, nglyphs;
+	unsigned int rectcap, compcap, glyphcap;
 };
 
 /* Drawable abstraction */
-Drw* drw_create(Display* dpy, int screen, Window root, unsigned int w, unsigned int h, Visual* visual, unsigned int depth, Colormap cmap);
-void drw_resize(Drw* drw, unsigned int w, unsigned int h);
+Drw* drw_create(Display* dpy, int screen, Window root, Visual* visual, unsigned int depth, Colormap cmap);
 void drw_free(Drw* drw);
 
+/* Srf abstraction */
+Srf* drw_surface_create(Drw* drw, unsigned int w, unsigned int h);
+void drw_surface_resize(Drw* drw, Srf* srf, unsigned int w, unsigned int h);
+void drw_surface_free(Drw* drw, Srf* srf);
+void drw_setsurface(Drw* drw, Srf* srf);
+
 /* Fnt abstraction */
 Fnt* drw_fontset_create(Drw* drw, const char* fonts[], size_t fontcount);
 void drw_fontset_free(Fnt* set);
@@ -60,12 +99,25 @@ Clr* drw_scm_create(Drw* drw, const char* const clrnames[], const unsigned int a
 /* Drawing context manipulation */
 void drw_setscheme(Drw* drw, Clr* scm);
 
+/* Pixel functions, these touch no X state and are safe off the main thread */
+void drw_pack_argb(long* pixels, size_t n);
+void drw_scale_argb(unsigned int* pixels, unsigned int* w, unsigned int* h, unsigned int dst_w, unsigned int dst_h);
 Picture drw_picture_create_resized(Drw* drw, char* src, unsigned int src_w, unsigned int src_h, unsigned int dst_w, unsigned int dst_h);
 
 /* Drawing functions */
 void drw_rect(Drw* drw, int x, int y, unsigned int w, unsigned int h, bool filled, bool invert);
+void drw_rects(Drw* drw, XRectangle* rects, unsigned int n, bool filled, bool invert);
 int drw_text(Drw* drw, int x, int y, unsigned int w, unsigned int h, unsigned int lpad, const char* text, bool invert);
 void drw_pic(Drw* drw, int x, int y, unsigned int w, unsigned int h, Picture pic);
+void drw_copy(Drw* drw, Srf* src, int sx, int sy, int x, int y, unsigned int w, unsigned int h);
+
+/* Display list, drawing functions only record until drw_flush() replays
+ * them grouped by kind and colour: backgrounds (text boxes and inverted
+ * rectangles), pictures, text and finally all other rectangles. Primitives
+ * of the same kind must not overlap and the surface must not change in
+ * between. */
+void drw_record(Drw* drw);
+void drw_flush(Drw* drw);
 
 /* Map functions */
 void drw_map(Drw* drw, Window win, int x, int y, unsigned int w, unsigned int h);
@@ -17,7 +17,9 @@
  * To understand everything else, start reading main().
  */
 
+#include <fcntl.h>
 #include <locale.h>
+#include <poll.h>
 #include <signal.h>
 #include <stdarg.h>
 #include <stdint.h>
@@ -25,6 +27,7 @@
 #include <unistd.h>
 #include <time.h>
 
+#include <sys/mman.h>
 #include <sys/types.h>
 #include <sys/stat.h>
 #include <sys/wait.h>
@@ -33,6 +36,7 @@
 #include <X11/keysym.h>
 #include <X11/Xatom.h>
 #include <X11/Xlib.h>
+#include <X11/Xlib-xcb.h>
 #include <X11/Xproto.h>
 #include <X11/Xutil.h>
 #include <X11/XKBlib.h>
@@ -41,8 +45,17 @@
 #ifdef XINERAMA
 	#include <X11/extensions/Xinerama.h>
 #endif /* XINERAMA */
+#ifdef XRANDR
+	#include <X11/extensions/Xrandr.h>
+#endif /* XRANDR */
+#ifdef XINPUT
+	#include <X11/extensions/XInput2.h>
+#endif /* XINPUT */
 #ifndef NODRW
+	#include <pthread.h>
+	#include <semaphore.h>
 	#include <X11/Xft/Xft.h>
+	#include <X11/extensions/XShm.h>
 #endif /* NODRW */
 
 #include "util.h"
@@ -58,7 +71,7 @@
 #define WIDTH(X)                ((X)->w + 2 * (X)->bw)
 #define HEIGHT(X)               ((X)->h + 2 * (X)->bw)
 #define TAGMASK                 ((1 << LENGTH(tags)) - 1)
-#define TEXTW(X)                (drw_fontset_getwidth(drw, (X)))
+#define TEXTW(X)                (drw_fontset_getwidth(bardrw, (X)))
 #define OPAQUE                  0xffU
 
 #if defined(__GNUC__) || defined(__clang__)
@@ -75,11 +88,23 @@ enum Scheme { SchemeNorm, SchemeSel }; /* color schemes */
 enum NetAtoms {
 	NetSupported, NetWMName, NetWMIcon, NetWMState, NetWMCheck,
 	NetWMFullscreen, NetActiveWindow, NetWMWindowType,
-	NetWMWindowTypeDialog, NetClientList, NetWMWindowsOpacity, NetLast
+	NetWMWindowTypeDialog, NetClientList, NetClientListStacking,
+	NetWMWindowsOpacity, NetLast
 }; /* EWMH atoms */
+enum Ewmh {
+	EwmhClientList = 1 << 0, EwmhStacking = 1 << 1,
+	EwmhActive = 1 << 2, EwmhState = 1 << 3
+}; /* properties publishewmh() has to write */
+enum RateClass {
+	RateConfigure, RateProperty, RateActivate, RateFocus, RateLast
+}; /* requests ratelimited() budgets per client */
 enum WMAtoms { WMProtocols, WMDelete, WMState, WMTakeFocus, WMLast }; /* default atoms */
+enum Prop {
+	PropNetName, PropName, PropTrans, PropClass, PropProtocols,
+	PropState, PropType, PropNormalHints, PropHints, PropLast
+}; /* properties prefetched for manage() */
 enum Clk {
-	ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle,
+	ClkTagBar, ClkLtSymbol, ClkStatusText, ClkWinTitle, ClkWinCounter,
 	ClkClientWin, ClkRootWin, ClkLast
 }; /* clicks */
 enum Position {
@@ -113,8 +138,105 @@ struct Button {
 
 typedef struct Monitor Monitor;
 typedef struct Client Client;
+typedef struct Prefetch Prefetch;
+struct Prefetch {
+	xcb_get_property_cookie_t cookie[PropLast];
+	xcb_get_property_reply_t* reply[PropLast]; /* once collected */
+	bool collected;
+	struct timespec mapreq; /* MapRequest arrival, zero when adopted by scan() */
+};
+#ifndef NODRW
+	typedef struct Icon Icon;
+	struct Icon {
+		uint64_t hash;      /* of the selected _NET_WM_ICON entry */
+		unsigned int w, h;  /* scaled size */
+		Picture pic;
+		unsigned long bytes; /* held by pic in the X server */
+		unsigned long drawn; /* publishbars() call which last showed it */
+		bool shown;         /* a client using it is visible, see evicticons() */
+		unsigned int refs;
+		Icon* next;
+	};
+	typedef struct IconLoad IconLoad;
+	struct IconLoad {
+		Window win;
+		unsigned int seq;       /* of the request this answers */
+		uint64_t hash;          /* 0 if the window has no usable icon */
+		unsigned int icw, ich;  /* scaled size */
+		unsigned int w, h;      /* of px, 0 if the icon was unchanged */
+		unsigned int px[];      /* premultiplied, within a factor of two of icw x ich */
+	};
+	/* last icon seen per WM_CLASS, persisted across restarts */
+	typedef struct ClassIcon ClassIcon;
+	struct ClassIcon {
+		uint64_t class, hash;
+		unsigned int icw, ich;
+		unsigned int w, h;
+		unsigned int* px;       /* into iconmap unless owned */
+		bool owned;
+		ClassIcon* next;
+	};
+	/* cache file layout: header, entries, then the pixels they point at */
+	typedef struct {
+		char magic[4];
+		uint32_t version, iconsize, n;
+	} IconFileHeader;
+	typedef struct {
+		uint64_t class, hash;
+		uint32_t icw, ich, w, h, offset, pad;
+	} IconFileEntry;
+	typedef struct BarSeg BarSeg;
+	struct BarSeg {
+		Window bar;
+		int x, w;
+		uint64_t hash;      /* content drawn in this segment */
+		bool dirty;         /* redrawn by the last renderbar() */
+		unsigned int click; /* what a click on it means */
+		Arg arg;
+		Window win;         /* client of a title, resolved on click */
+	};
+	/* What the bar thread draws, copied out of the client and monitor
+	 * lists so that it never touches them. */
+	typedef struct {
+		char name[256];
+		Window win;
+		Picture icon;           /* None while there is none */
+		unsigned int icw, ich;
+		uint64_t iconhash;
+		bool sel, pending, ontop;
+	} BarTitle;
+	typedef struct {
+		Window win;
+		int bw, bh;
+		unsigned long exposed;  /* see Monitor.exposed */
+		bool status;            /* draw the status text */
+		struct { bool sel; int n, seln; } tags[31]; /* see NumTags */
+		int lt;                 /* into layouts, -1 for no symbol */
+		unsigned int hidden[2]; /* titles scrolled off left and right */
+		Window hiddenwin[2];    /* the nearest of either, focused on click */
+		unsigned int title, ntitles; /* slice of BarFrame.titles */
+	} BarState;
+	typedef struct {
+		unsigned long seq;
+		char status[512];
+		BarState* bars;
+		BarTitle* titles;
+		unsigned int nbars, ntitles, barcap, titlecap;
+	} BarFrame;
+	/* the bar thread's side of a bar */
+	typedef struct {
+		Window win;
+		Srf* srf;
+		BarSeg* segs;           /* what srf currently holds */
+		unsigned int nsegs, segcap;
+		unsigned long seq;      /* last frame drawn */
+		bool live;
+		bool stale;             /* the server refused part of the last draw */
+	} BarCtx;
+#endif /* NODRW */
 struct Client {
 	char name[256];
+	char class[128], instance[128];
 	float mina, maxa;
 	int x, y, w, h;
 	int oldx, oldy, oldw, oldh;
@@ -125,13 +247,37 @@ struct Client {
 	enum Position position, oldposition;
 	bool isunresizeable, isalwaysontop, isurgent, neverfocus;
 	bool ignorehints, hintsvalid;
+	/* properties cached at manage, refreshed from PropertyNotify */
+	unsigned int protocols; /* bit per supported wmatom index */
+	XWMHints wmhints;
+	bool haswmhints;
+	unsigned int ownhints;  /* our WM_HINTS writes not yet notified, see ownproperty() */
+	Atom wintype, winstate;
+	struct timespec mapreq; /* until the MapNotify, see eventmapnotify() */
+	bool hasnetname;        /* WM_NAME changes can be ignored */
+	int rx, ry, rw, rh, rbw; /* geometry the client was last told about */
+	/* token buckets, see ratelimited() */
+	float tokens[RateLast];
+	unsigned long refilled[RateLast]; /* ms */
+	unsigned long limited;  /* events deferred, for printstats() */
+	unsigned int deferred;  /* 1 << enum RateClass waiting for applydeferred() */
+	XConfigureRequestEvent pendconf; /* merged */
+	XEvent pendmsg, pendfocus; /* latest */
+	#define PENDPROPS 16
+	Atom pendprops[PENDPROPS];
+	unsigned int npendprops;
+	bool pendoverflow;      /* more atoms than fit, applydeferred() reads them all */
+	bool statedirty;        /* _NET_WM_STATE not yet written */
 	Client* next;
 	Client* snext;
 	Monitor* mon;
 	Window win;
 	#ifndef NODRW
-		Picture icon;
-		unsigned int icw, ich;
+		Icon* icon;
+		uint64_t classhash;     /* of WM_CLASS, keys the icon file cache */
+		unsigned int iconseq;   /* of the last requested load */
+		bool iconpending;
+		bool iconstale;         /* _NET_WM_ICON changed, loaded once the title is drawn */
 	#endif /* NODRW */
 };
 
@@ -157,11 +303,14 @@ struct Monitor {
 	unsigned char num;
 	#ifndef NODRW
 		Window barwin;
+		unsigned long exposed;      /* first frame after barwin lost its contents */
 		bool showbar, topbar;
 		int bx, by, bw, bh;         /* bar geometry */
 	#endif /* NODRW */
 	int mx, my, mw, mh;             /* screen size */
 	int oldmx, oldmy, oldmw, oldmh; /* screen size old */
+	Atom output;                    /* RandR monitor name, None without RandR */
+	bool changed;                   /* geometry or clients, see applygeom() */
 	int wx, wy, ww, wh;             /* window area  */
 	int gapwindow, gapbar, gapedge; /* gaps in px */
 	Tag seltags;
@@ -227,12 +376,25 @@ static void eventdestroynotify(XEvent* e);
 static void evententernotify(XEvent *e);
 static void eventfocusin(XEvent* e);
 static void eventkeypress(XEvent* e);
+static void eventleavenotify(XEvent* e);
 static void eventmappingnotify(XEvent* e);
+static void eventmapnotify(XEvent* e);
 static void eventmaprequest(XEvent* e);
 static void eventmotionnotify(XEvent *e);
 static void eventpropertynotify(XEvent* e);
 static void eventunmapnotify(XEvent* e);
 static void eventhandle(XEvent* ev);
+static bool ownproperty(XPropertyEvent* ev);
+static bool ratelimited(XEvent* ev);
+static void applydeferred(void);
+static void applygeom(void);
+static unsigned long nowms(void);
+static bool batchend(unsigned long* due);
+static void clickfocused(Time t);
+
+#ifdef XINPUT
+	static void eventgeneric(XEvent* e);
+#endif /* XINPUT */
 
 #ifndef NODRW
 	static void eventexpose(XEvent* e);
@@ -249,8 +411,13 @@ static void (*const eventhandler[LASTEvent]) (XEvent*) = {
 		[Expose] = eventexpose,
 	#endif
 	[FocusIn] = eventfocusin,
+	#ifdef XINPUT
+		[GenericEvent] = eventgeneric,
+	#endif /* XINPUT */
 	[KeyPress] = eventkeypress,
+	[LeaveNotify] = eventleavenotify,
 	[MappingNotify] = eventmappingnotify,
+	[MapNotify] = eventmapnotify,
 	[MapRequest] = eventmaprequest,
 	[MotionNotify] = eventmotionnotify,
 	[PropertyNotify] = eventpropertynotify,
@@ -268,7 +435,8 @@ static void autostartexec(void);
 static void checkotherwm(void);
 static void cleanup(void);
 static void cleanupmon(Monitor* mon);
-static void configure(Client* c);
+static void configure(Client* c, bool force);
+static void reported(Client* c);
 static Monitor* createmon(void);
 static void detach(Client* c);
 static void detachstack(Client* c);
@@ -277,12 +445,15 @@ static void focus(Client* c);
 static void focusmon(Monitor* m, bool refocus);
 static Atom getatomprop(Client* c, Atom prop);
 static int getrootptr(int* x, int* y);
-static unsigned long getstate(Window w);
 static int gettextprop(Window w, Atom atom, char* text, unsigned int size);
+static void copytextprop(const XTextProperty* prop, char* text, unsigned int size);
+static int getutf8prop(Window w, Atom atom, char* text, unsigned int size);
+static unsigned int utf8trim(const char* s, unsigned int len);
 static void grabbuttons(Client* c, bool focused);
 static void grabkeys(void);
 static void killclient(Client* c);
-static Client* manage(Window w, XWindowAttributes* wa);
+static Client* adopt(Window w, XWindowAttributes* wa, Prefetch* pf);
+static Client* manage(Window w, XWindowAttributes* wa, Prefetch* pf);
 static Client* nexttiled(Client* c);
 static void opacity(Client* c, float opacity);
 static void opacitywin(Window w, float opacity);
@@ -293,14 +464,25 @@ static void resizeclient(Client* c, int x, int y, int w, int h);
 static void setpositionmove(Client* c, enum Position position, bool force);
 static void setposition(Client* c, enum Position position, bool force);
 static void restack(Monitor* m);
+static void raiseclient(Client* c);
+static void stacktop(Window w);
 static void run(void);
+static void prefetch(Window w, Prefetch* pf);
+static void collectprefetch(Prefetch* pf);
+static void discardprefetch(Prefetch* pf);
+static const uint32_t* propitems(const xcb_get_property_reply_t* r, Atom type, unsigned int min);
+static int proptext(const xcb_get_property_reply_t* r, char* text, unsigned int size);
+static unsigned int protocolbit(Atom a);
 static void scan(void);
-static int sendevent(Client* c, Atom proto);
+static int sendevent(Client* c, int proto);
+static void printstats(void);
 static void sendmon(Client* c, Monitor* m, bool refocus);
+static void sigstats(int unused);
 static void setclientstate(Client* c, long state);
 static void setfocus(Client* c);
 static void setmaster(Client* c);
 static void setup(void);
+static void tracephase(const char* phase);
 static void seturgent(Client* c, int urg);
 static void hideclient(Client* c);
 static void showhide(Client* c);
@@ -309,13 +491,20 @@ static void freeclient(Client* c);
 static void unfocus(Client* c, bool setfocus);
 static void unmanage(Client* c, bool destroyed);
 static void updatebarpos(Monitor* m);
+static void updateclass(Client* c);
+static void setclass(Client* c, const char* instance, const char* class);
 static void updateclientlist(void);
+static void publishewmh(void);
+static void setactive(Window w);
 static int updategeom(void);
 static void updatenumlockmask(void);
+static void updateprotocols(Client* c);
 static void updatesizehints(Client* c);
-static void updatetitle(Client* c);
+static void setsizehints(Client* c, const XSizeHints* size);
+static bool updatetitle(Client* c);
 static void updatewindowtype(Client* c);
 static void updatewmhints(Client* c);
+static void setwmhints(Client* c, const XWMHints* wmh);
 static Client* wintoclient(Window w);
 static Monitor* wintomon(Window w);
 static int xerror(Display* dpy, XErrorEvent* ee);
@@ -323,10 +512,39 @@ static int xerrordummy(Display* dpy, XErrorEvent* ee);
 static int xerrorstart(Display* dpy, XErrorEvent* ee);
 
 #ifndef NODRW
+	static void applyicon(Client* c, IconLoad* l);
+	static void* barloop(void* arg);
+	static bool barseg(BarCtx* ctx, unsigned int n, int x, int w, uint64_t hash, unsigned int click, Arg arg, Window win);
 	static void buttonbar(XButtonPressedEvent* ev, Arg* arg, unsigned int* click);
-	static void drawbar(Monitor* m);
+	static void drainicons(void);
 	static void drawbars(void);
+	static void drawcounter(BarCtx* ctx, unsigned int n, int x, int w, const char* label, Window win, int barh);
+	static void drawicon(const BarTitle* t, int x, unsigned int barh, unsigned int w);
+	static void freepicture(Picture pic);
+	static void openbar(void);
+	static void* openbarasync(void* arg);
+	static void publishbars(void);
+	static void reappictures(void);
+	static void renderbar(BarCtx* ctx, const BarFrame* f, const BarState* b);
+	static void renderframe(const BarFrame* f);
+	static void startbar(void);
+	static void stopbar(void);
+	static void evicticons(void);
+	static ClassIcon* getclassicon(uint64_t class);
+	static bool iconcachepath(char* path, size_t size, const char* name, bool create);
 	static void freeicon(Client* c);
+	static Icon* geticon(uint64_t hash, unsigned int w, unsigned int h);
+	static void* iconworker(void* arg);
+	static void loadiconcache(void);
+	static Icon* newicon(uint64_t hash, unsigned int* px, unsigned int w, unsigned int h, unsigned int icw, unsigned int ich);
+	static void saveiconcache(void);
+	static void setclassicon(uint64_t class, const IconLoad* l);
+	static long* iconprop(Display* xdpy, Window win, long o, long n, unsigned long* left);
+	static IconLoad* loadicon(Display* xdpy, Window win, unsigned int seq, uint64_t known);
+	static void starticonworker(void);
+	static void stopiconworker(void);
+	static void resizebar(Monitor* m);
+	static void updateatlas(void);
 	static void updatebars(void);
 	static void updateicon(Client* c);
 	static void updatestatus(void);
@@ -341,9 +559,39 @@ static int (*xerrorxlib)(Display*, XErrorEvent*);
 static unsigned int numlockmask = 0;
 static Atom wmatom[WMLast], netatom[NetLast];
 static bool running = true;
+static volatile sig_atomic_t dumpstats; /* set by SIGUSR1 */
 static Cursor cursor[CurLast];
 static Clr** scheme;
 static Display* dpy;
+static xcb_connection_t* xcon; /* dpy's, for requests answered out of order */
+static struct { unsigned long n, total, max; } maplatency; /* microseconds */
+static unsigned int ewmhdirty; /* enum Ewmh, written once the event queue is drained */
+static unsigned long ewmhdue; /* see batchend() */
+static Window activewin;
+static Atom utf8string;
+static struct { unsigned long updates, unchanged, shadowed; } titlestats;
+static unsigned long deferdue; /* ms when applydeferred() runs, 0 if nothing waits */
+#define GEOMSETTLE 150 /* ms without screen events before applygeom() */
+static unsigned long geomdue;
+#define BATCHMS 16 /* longest a flood of events holds back a frame, see batchend() */
+#ifdef XRANDR
+	static bool userandr; /* 1.5 or later, monitors from XRRGetMonitors */
+	static int randrbase;
+#endif /* XRANDR */
+static struct { unsigned long sent, skipped; } configurestats; /* synthetic ConfigureNotify */
+static bool xiclick; /* clicks seen as XI2 raw events, client windows are not grabbed */
+static Client* hovered; /* client under the pointer, from Enter/LeaveNotify */
+static bool pointergrab; /* a client grabbed the pointer, clicks are its own */
+static struct { unsigned long n, total, max; uint32_t skew; } clicklatency; /* ms */
+#ifdef XINPUT
+	static int xiopcode;
+	static int xkbbase;
+	static unsigned int xkbmods; /* from XkbStateNotify, raw events carry no state */
+#endif /* XINPUT */
+static bool trace; /* -T, startup phases to stderr */
+static struct timespec tracestart;
+static Window* stacking; /* clients bottom to top, for _NET_CLIENT_LIST_STACKING */
+static int nstacking, stackingcap;
 static Monitor* mons;
 static Monitor* selmon;
 static Window root, wmcheckwin;
@@ -352,7 +600,49 @@ static long dummy;
 #define dummyptr (&dummy)
 
 #ifndef NODRW
-	static Drw* drw;
+	static Drw* drw; /* icon uploads on the main thread */
+	static Icon* icons; /* shared by every client showing the same pixels */
+	static unsigned long iconbytes, iconpeak;
+	static unsigned long drawtick;
+	#define ICONFILEMAX 128 /* entries kept in the icon cache file */
+	static ClassIcon* classicons; /* most recently used first */
+	static void* iconmap;
+	static size_t iconmapsize;
+	/* icon worker, single producer single consumer rings in both directions */
+	#define ICONQUEUE 64 /* power of two */
+	static struct { Window win; unsigned int seq; uint64_t hash; } iconjobs[ICONQUEUE];
+	static IconLoad* icondone[ICONQUEUE];
+	static unsigned int jobhead, jobtail, donehead, donetail;
+	static sem_t iconjobsem, iconslotsem;
+	static pthread_t iconthread;
+	static Display* icondpy; /* the worker's own connection */
+	static Atom iconready;
+	static bool iconquit;
+	/* bar thread, with its own connection and drawing context; the main
+	 * thread hands it frames through a triple buffer of BarFrame */
+	static Display* bardpy;
+	static Drw* bardrw;
+	static pthread_t barthread;
+	static pthread_t fontthread; /* openbar() during setup() */
+	static sem_t barsem;
+	static bool barrunning, barquit;
+	static bool barsdirty; /* publish once the event queue is drained */
+	static unsigned long barsdue; /* see batchend() */
+	static bool barsync; /* dpy created pictures or bar windows since the last frame */
+	static bool barerror; /* set by xerror() on the bar thread */
+	#define FRAMEFRESH 4
+	static unsigned int framefill = 0, framelatest = 1, framedraw = 2;
+	static unsigned long frameseq, bardone; /* last frame published, drawn */
+	static struct { Picture pic; unsigned long seq; }* graves; /* see freepicture() */
+	static unsigned int ngraves, gravecap;
+	static BarSeg* hits; /* what the bar thread last drew, for buttonbar() */
+	static unsigned int nhits, hitcap;
+	static pthread_mutex_t hitlock = PTHREAD_MUTEX_INITIALIZER;
+	/* owned by the bar thread once it runs */
+	static BarCtx* barctxs;
+	static unsigned int nbarctxs;
+	static Srf* atlas; /* pre-rendered tag labels and layout symbols */
+	static int stextw;
 	static char stext[512];
 	static int textpad;
 	static int useargb = 0;
@@ -370,6 +660,12 @@ static long dummy;
 /* compile-time check if all tags fit into an unsigned int bit array. */
 struct NumTags { char limitexceeded[LENGTH(tags) > 31 ? -1 : 1]; };
 
+#ifndef NODRW
+	/* atlas cells, one row per scheme, see updateatlas() */
+	static int tagx[LENGTH(tags)], tagw[LENGTH(tags)], ltx[LENGTH(layouts)];
+	static BarFrame frames[3];
+#endif /* NODRW */
+
 /* layout implementations */
 
 void ltcol(Monitor* m, unsigned int n) {
@@ -543,7 +839,7 @@ void cmdinclayout(const Arg arg) {
 		arrange(selmon);
 	} else {
 		#ifndef NODRW
-			drawbar(selmon);
+			drawbars();
 		#endif
 	}
 }
@@ -721,9 +1017,9 @@ void cmdsetgapbar(const Arg arg) {
 		else
 			selmon->gapbar += arg.i;
 		updatebarpos(selmon);
-		XMoveResizeWindow(dpy, selmon->barwin, selmon->bx, selmon->by, selmon->bw, selmon->bh);
+		resizebar(selmon);
 		arrange(selmon);
-		drawbar(selmon);
+		drawbars();
 	#endif /* NODRW */
 }
 
@@ -735,7 +1031,7 @@ void cmdsetgapedge(const Arg arg) {
 	updatebarpos(selmon);
 	arrange(selmon);
 	#ifndef NODRW
-		drawbar(selmon);
+		drawbars();
 	#endif /* NODRW */
 }
 
@@ -748,7 +1044,7 @@ void cmdsetlayout(const Arg arg) {
 		arrange(selmon);
 	} else {
 		#ifndef NODRW
-			drawbar(selmon);
+			drawbars();
 		#endif /* NODRW */
 	}
 }
@@ -821,7 +1117,7 @@ void cmdtogglebar(const Arg arg) {
 		selmon->showbar = !selmon->showbar;
 		updatebarpos(selmon);
 		if (selmon->showbar) {
-			XMoveResizeWindow(dpy, selmon->barwin, selmon->bx, selmon->by, selmon->bw, selmon->bh);
+			resizebar(selmon);
 			XMapWindow(dpy, selmon->barwin);
 		} else {
 			XUnmapWindow(dpy, selmon->barwin);
@@ -939,9 +1235,12 @@ void eventbuttonpress(XEvent* e) {
 			} else
 		#endif /* NODRW */
 		if ((c = wintoclient(ev->window))) {
+			bool unfocused = c != selmon->sel;
 			if (focusonwheel || (ev->button != Button4 && ev->button != Button5))
 				focus(c);
 			XAllowEvents(dpy, ReplayPointer, CurrentTime);
+			if (unfocused && !xiclick)
+				clickfocused(ev->time); /* the pointer was frozen until now */
 			click = ClkClientWin;
 		}
 	}
@@ -953,6 +1252,12 @@ void eventbuttonpress(XEvent* e) {
 
 void eventclientmessage(XEvent* e) {
 	XClientMessageEvent* cme = &e->xclient;
+	#ifndef NODRW
+		if (cme->window == wmcheckwin && cme->message_type == iconready) {
+			drainicons();
+			return;
+		}
+	#endif /* NODRW */
 	Client* c = wintoclient(cme->window);
 	if (!c)
 		return;
@@ -979,39 +1284,9 @@ void eventconfigurenotify(XEvent* e) {
 	XConfigureEvent* ev = &e->xconfigure;
 	if (ev->window != root)
 		return;
-
-	/* TODO: updategeom handling sucks, needs to be simplified */
-	int dirty = (sw != ev->width || sh != ev->height);
 	sw = ev->width;
 	sh = ev->height;
-	for (Monitor* m = mons; m; m = m->next) {
-		m->oldmx = m->mx;
-		m->oldmy = m->my;
-		m->oldmw = m->mw;
-		m->oldmh = m->mh;
-	}
-	if (updategeom() || dirty) {
-		#ifndef NODRW
-			drw_resize(drw, sw, sh);
-			updatebars();
-		#endif /* NODRW */
-		for (Monitor* m = mons; m; m = m->next) {
-			for (Client* c = m->clients; c; c = c->next) {
-				if (c->position == PositionNone)
-					resizeclient(c,
-						c->x * m->mw / m->oldmw,
-						c->y * m->mh / m->oldmh,
-						c->w * m->mw / m->oldmw,
-						c->h * m->mh / m->oldmh
-					);
-			}
-			#ifndef NODRW
-				XMoveResizeWindow(dpy, m->barwin, m->bx, m->by, m->bw, m->bh);
-			#endif /* NODRW */
-		}
-		focus(NULL);
-		arrange(NULL);
-	}
+	geomdue = nowms() + GEOMSETTLE;
 }
 
 void eventconfigurerequest(XEvent* e) {
@@ -1045,11 +1320,14 @@ void eventconfigurerequest(XEvent* e) {
 			if ((c->y + c->h) > m->my + m->mh && c->position == PositionNone)
 				c->y = m->my + (m->mh / 2 - HEIGHT(c) / 2); /* center in y direction */
 			if ((ev->value_mask & (CWX | CWY)) && !(ev->value_mask & (CWWidth | CWHeight)))
-				configure(c);
-			if (ISVISIBLE(c))
+				configure(c, false);
+			if (ISVISIBLE(c)) {
+				if (c->w != c->rw || c->h != c->rh)
+					reported(c);
 				XMoveResizeWindow(dpy, c->win, c->x, c->y, c->w, c->h);
+			}
 		} else {
-			configure(c);
+			configure(c, true); /* refused, confirm what it has */
 		}
 	} else {
 		XWindowChanges wc;
@@ -1074,10 +1352,14 @@ void eventdestroynotify(XEvent* e) {
 
 void evententernotify(XEvent *e) {
 	XCrossingEvent *ev = &e->xcrossing;
+	if (ev->mode != NotifyGrab)
+		pointergrab = false;
+	if (ev->mode == NotifyUngrab)
+		hovered = wintoclient(ev->window); /* where the pointer is once the grab ends */
 	if ((ev->mode != NotifyNormal || ev->detail == NotifyInferior) && ev->window != root)
 		return;
 	
-	Client *c = wintoclient(ev->window);
+	Client *c = hovered = wintoclient(ev->window);
 	if (!c) return;
 	if (!focusonhover) {
 		if (focusmononhover)
@@ -1091,8 +1373,12 @@ void evententernotify(XEvent *e) {
 	void eventexpose(XEvent* e) {
 		XExposeEvent* ev = &e->xexpose;
 		Monitor* m;
-		if (ev->count == 0 && (m = wintomon(ev->window)))
-			drawbar(m);
+		if (!(m = wintomon(ev->window)) || ev->window != m->barwin || ev->count != 0)
+			return;
+		/* the bar thread copies its surface over the whole window in
+		 * the next frame it draws, even if it skips this one */
+		m->exposed = frameseq + 1;
+		drawbars();
 	}
 #endif
 
@@ -1142,6 +1428,15 @@ void eventkeypress(XEvent* e) {
 	}
 }
 
+void eventleavenotify(XEvent* e) {
+	XCrossingEvent* ev = &e->xcrossing;
+	if (ev->mode == NotifyGrab)
+		pointergrab = true; /* until the EnterNotify of the ungrab */
+	else if (ev->mode == NotifyNormal && ev->detail != NotifyInferior
+		&& hovered && hovered->win == ev->window)
+		hovered = NULL;
+}
+
 void eventmappingnotify(XEvent* e) {
 	XMappingEvent* ev = &e->xmapping;
 	XRefreshKeyboardMapping(ev);
@@ -1149,13 +1444,37 @@ void eventmappingnotify(XEvent* e) {
 		grabkeys();
 }
 
+void eventmapnotify(XEvent* e) {
+	XMapEvent* ev = &e->xmap;
+	Client* c;
+	struct timespec now;
+	unsigned long us;
+
+	if (!(c = wintoclient(ev->window)) || (!c->mapreq.tv_sec && !c->mapreq.tv_nsec))
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - c->mapreq.tv_sec) * 1000000 + (now.tv_nsec - c->mapreq.tv_nsec) / 1000;
+	c->mapreq.tv_sec = c->mapreq.tv_nsec = 0;
+	maplatency.n++;
+	maplatency.total += us;
+	maplatency.max = MAX(maplatency.max, us);
+}
+
 void eventmaprequest(XEvent* e) {
 	XMapRequestEvent* ev = &e->xmaprequest;
 	XWindowAttributes wa;
-	if (!XGetWindowAttributes(dpy, ev->window, &wa) || wa.override_redirect)
+	Prefetch pf;
+	if (wintoclient(ev->window))
+		return;
+	/* the properties travel with the attribute request, one round trip for both */
+	prefetch(ev->window, &pf);
+	clock_gettime(CLOCK_MONOTONIC, &pf.mapreq);
+	if (!XGetWindowAttributes(dpy, ev->window, &wa) || wa.override_redirect) {
+		discardprefetch(&pf);
+		XSelectInput(dpy, ev->window, NoEventMask);
 		return;
-	if (!wintoclient(ev->window))
-		manage(ev->window, &wa);
+	}
+	manage(ev->window, &wa, &pf);
 }
 
 void eventpropertynotify(XEvent* e) {
@@ -1165,10 +1484,29 @@ void eventpropertynotify(XEvent* e) {
 		#ifndef NODRW
 			updatestatus();
 		#endif /* NODRW */
-	} else if (ev->state == PropertyDelete) {
-		return; /* ignore */
 	} else if ((c = wintoclient(ev->window))) {
 		Window trans;
+		/* keep the property cache exact, deletions included */
+		if (ev->atom == wmatom[WMProtocols])
+			updateprotocols(c);
+		else if (ev->atom == XA_WM_CLASS)
+			updateclass(c);
+		else if (ev->atom == netatom[NetWMState])
+			c->winstate = getatomprop(c, netatom[NetWMState]);
+		else if (ev->atom == netatom[NetWMWindowType])
+			c->wintype = getatomprop(c, netatom[NetWMWindowType]);
+		else if (ev->atom == XA_WM_HINTS && ev->state == PropertyDelete) {
+			setwmhints(c, NULL);
+			#ifndef NODRW
+				drawbars();
+			#endif /* NODRW */
+		}
+		else if (ev->atom == XA_WM_NORMAL_HINTS)
+			c->hintsvalid = false;
+		else if (ev->atom == netatom[NetWMName] && ev->state == PropertyDelete)
+			c->hasnetname = false;
+		if (ev->state == PropertyDelete)
+			return;
 		switch (ev->atom) {
 			default: break;
 			case XA_WM_TRANSIENT_FOR:
@@ -1176,9 +1514,6 @@ void eventpropertynotify(XEvent* e) {
 					setposition(c, PositionNone, false);
 				}
 				break;
-			case XA_WM_NORMAL_HINTS:
-				c->hintsvalid = false;
-				break;
 			case XA_WM_HINTS:
 				updatewmhints(c);
 				#ifndef NODRW
@@ -1186,18 +1521,19 @@ void eventpropertynotify(XEvent* e) {
 				#endif /* NODRW */
 				break;
 		}
+		if (ev->atom == XA_WM_NAME && c->hasnetname)
+			titlestats.shadowed++; /* _NET_WM_NAME wins */
 		#ifdef NODRW
-			if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName])
+			else if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName])
 				updatetitle(c);
 		#else
-			if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
-				updatetitle(c);
-				if (c == c->mon->sel)
-					drawbar(c->mon);
+			else if (ev->atom == XA_WM_NAME || ev->atom == netatom[NetWMName]) {
+				if (updatetitle(c) && ISVISIBLE(c))
+					drawbars();
 			} else if (ev->atom == netatom[NetWMIcon]) {
-				updateicon(c);
-				if (c == c->mon->sel)
-					drawbar(c->mon);
+				c->iconstale = true;
+				if (ISVISIBLE(c))
+					drawbars();
 			}
 		#endif
 		if (ev->atom == netatom[NetWMWindowType])
@@ -1217,22 +1553,267 @@ void eventunmapnotify(XEvent* e) {
 	}
 }
 
+#ifdef XINPUT
+	void eventgeneric(XEvent* e) {
+		XGenericEventCookie* cookie = &e->xcookie;
+		if (cookie->extension != xiopcode || cookie->evtype != XI_RawButtonPress
+			|| !XGetEventData(dpy, cookie))
+			return;
+		/* the click has already reached the client, focus follows it */
+		XIRawEvent* ev = cookie->data;
+		bool focusing = hovered && !pointergrab && hovered != selmon->sel && ISVISIBLE(hovered)
+			&& (focusonwheel || (ev->detail != Button4 && ev->detail != Button5));
+		/* bound clicks are grabbed, eventbuttonpress() handles them */
+		for (unsigned int i = 0; focusing && i < LENGTH(buttons); i++)
+			if (buttons[i].click == ClkClientWin && buttons[i].button == (unsigned int)ev->detail
+				&& CLEANMASK(buttons[i].mask) == CLEANMASK(xkbmods))
+				focusing = false;
+		if (focusing) {
+			focus(hovered);
+			clickfocused(ev->time);
+		}
+		XFreeEventData(dpy, cookie);
+	}
+#endif /* XINPUT */
+
 void eventhandle(XEvent* ev) {
-	if (eventhandler[ev->type])
+	#ifdef XRANDR
+		if (userandr && (ev->type == randrbase + RRScreenChangeNotify || ev->type == randrbase + RRNotify)) {
+			XRRUpdateConfiguration(ev);
+			geomdue = nowms() + GEOMSETTLE; /* outputs come and go in bursts */
+			return;
+		}
+	#endif /* XRANDR */
+	#ifdef XINPUT
+		if (xiclick && ev->type == xkbbase) {
+			XkbEvent* xe = (XkbEvent*)ev;
+			if (xe->any.xkb_type == XkbStateNotify)
+				xkbmods = xe->state.mods;
+			return;
+		}
+	#endif /* XINPUT */
+	if (ev->type == PropertyNotify && ownproperty(&ev->xproperty))
+		return;
+	if (ev->type < LASTEvent && eventhandler[ev->type] && !ratelimited(ev))
 		eventhandler[ev->type](ev); /* call eventhandler */
 }
 
+/* The notification of a property we wrote ourselves, whose value the
+ * cache already holds. Each write is notified once and in order, so a
+ * count per client is enough to tell them apart from the client's own. */
+bool ownproperty(XPropertyEvent* ev) {
+	Client* c;
+
+	if (ev->atom != XA_WM_HINTS || ev->state != PropertyNewValue
+		|| !(c = wintoclient(ev->window)) || !c->ownhints)
+		return false;
+	c->ownhints--;
+	return true;
+}
+
+/* Charge the client an event sends it from its bucket for that kind of
+ * event; when it is empty, keep only the latest state of the request for
+ * applydeferred() and report true. */
+bool ratelimited(XEvent* ev) {
+	Client* c;
+	int k;
+	unsigned long now;
+
+	switch (ev->type) {
+		default: return false;
+		case ConfigureRequest: k = RateConfigure; c = wintoclient(ev->xconfigurerequest.window); break;
+		case PropertyNotify:
+			/* written by dwm itself */
+			if (ev->xproperty.atom == wmatom[WMState] || ev->xproperty.atom == netatom[NetWMState]
+				|| ev->xproperty.atom == netatom[NetWMWindowsOpacity])
+				return false;
+			k = RateProperty;
+			c = wintoclient(ev->xproperty.window);
+			break;
+		case FocusIn: k = RateFocus; c = wintoclient(ev->xfocus.window); break;
+		case ClientMessage:
+			if (ev->xclient.message_type != netatom[NetActiveWindow])
+				return false;
+			k = RateActivate;
+			c = wintoclient(ev->xclient.window);
+			break;
+	}
+	if (!c)
+		return false;
+	now = nowms();
+	c->tokens[k] = MIN(rateburst, c->tokens[k] + (now - c->refilled[k]) * ratepersec / 1000.0);
+	c->refilled[k] = now;
+	if (c->tokens[k] >= 1) {
+		c->tokens[k]--;
+		return false;
+	}
+
+	switch (k) {
+		case RateConfigure: {
+			XConfigureRequestEvent* pc = &c->pendconf;
+			const XConfigureRequestEvent* e = &ev->xconfigurerequest;
+			if (!(c->deferred & 1 << RateConfigure))
+				*pc = *e;
+			else {
+				if (e->value_mask & CWX) pc->x = e->x;
+				if (e->value_mask & CWY) pc->y = e->y;
+				if (e->value_mask & CWWidth) pc->width = e->width;
+				if (e->value_mask & CWHeight) pc->height = e->height;
+				if (e->value_mask & CWBorderWidth) pc->border_width = e->border_width;
+				if (e->value_mask & CWSibling) pc->above = e->above;
+				if (e->value_mask & CWStackMode) pc->detail = e->detail;
+				pc->value_mask |= e->value_mask;
+			}
+			break;
+		}
+		case RateProperty: {
+			unsigned int i;
+			for (i = 0; i < c->npendprops && c->pendprops[i] != ev->xproperty.atom; i++);
+			if (i < c->npendprops)
+				break;
+			if (i < PENDPROPS)
+				c->pendprops[c->npendprops++] = ev->xproperty.atom;
+			else
+				c->pendoverflow = true;
+			break;
+		}
+		case RateActivate: c->pendmsg = *ev; break;
+		case RateFocus: c->pendfocus = *ev; break;
+	}
+	c->deferred |= 1 << k;
+	c->limited++;
+	if (!deferdue)
+		deferdue = now + 1000 / ratepersec;
+	return true;
+}
+
+/* Monitors once a burst of RandR or root configure events has settled,
+ * only the ones that changed are arranged again. */
+void applygeom(void) {
+	Client* sel = selmon->sel; /* clients outlive updategeom(), monitors may not */
+
+	geomdue = 0;
+	for (Monitor* m = mons; m; m = m->next) {
+		m->oldmx = m->mx;
+		m->oldmy = m->my;
+		m->oldmw = m->mw;
+		m->oldmh = m->mh;
+		m->changed = false;
+	}
+	if (!updategeom())
+		return;
+	#ifndef NODRW
+		updatebars();
+	#endif /* NODRW */
+	/* other monitors keep their focus and stacking */
+	if (selmon->changed || selmon->sel != sel)
+		focus(NULL);
+	for (Monitor* m = mons; m; m = m->next) {
+		if (!m->changed)
+			continue;
+		if (m->oldmw && m->oldmh)
+			for (Client* c = m->clients; c; c = c->next)
+				if (c->position == PositionNone)
+					resizeclient(c,
+						c->x * m->mw / m->oldmw,
+						c->y * m->mh / m->oldmh,
+						c->w * m->mw / m->oldmw,
+						c->h * m->mh / m->oldmh
+					);
+		#ifndef NODRW
+			resizebar(m);
+		#endif /* NODRW */
+		arrange(m);
+		m->changed = false;
+	}
+}
+
+/* what ratelimited() held back, one merged event per client and kind */
+void applydeferred(void) {
+	XEvent ev;
+
+	deferdue = 0;
+	for (Monitor* m = mons; m; m = m->next)
+		for (Client* c = m->clients; c; c = c->next) {
+			if (c->deferred & 1 << RateConfigure) {
+				ev.xconfigurerequest = c->pendconf;
+				eventconfigurerequest(&ev);
+			}
+			if (c->deferred & 1 << RateProperty) {
+				/* every property eventpropertynotify() keeps, for when
+				 * some of the atoms could not be recorded */
+				const Atom tracked[] = {
+					wmatom[WMProtocols], XA_WM_CLASS, XA_WM_TRANSIENT_FOR,
+					netatom[NetWMState], netatom[NetWMWindowType],
+					XA_WM_HINTS, XA_WM_NORMAL_HINTS,
+					netatom[NetWMName], XA_WM_NAME, netatom[NetWMIcon]
+				};
+				const Atom* props = c->pendoverflow ? tracked : c->pendprops;
+				unsigned int n = c->pendoverflow ? LENGTH(tracked) : c->npendprops;
+				for (unsigned int i = 0; i < n; i++) {
+					/* handlers fetch the value, a deletion reads as missing */
+					ev.xproperty = (XPropertyEvent){ .type = PropertyNotify, .display = dpy,
+						.window = c->win, .atom = props[i], .state = PropertyNewValue };
+					eventpropertynotify(&ev);
+				}
+			}
+			if (c->deferred & 1 << RateActivate)
+				eventclientmessage(&c->pendmsg);
+			if (c->deferred & 1 << RateFocus)
+				eventfocusin(&c->pendfocus);
+			c->deferred = 0;
+			c->npendprops = 0;
+			c->pendoverflow = false;
+		}
+}
+
+unsigned long nowms(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+
+/* A batch of events ends when the queue is drained, or BATCHMS after
+ * the first check that found it still full, so that a flood cannot
+ * hold back the work done once per batch. */
+bool batchend(unsigned long* due) {
+	unsigned long now;
+
+	if (!XPending(dpy)) {
+		*due = 0;
+		return true;
+	}
+	now = nowms();
+	if (!*due) {
+		*due = now + BATCHMS;
+	} else if ((long)(*due - now) <= 0) {
+		*due = 0;
+		return true;
+	}
+	return false;
+}
+
+/* Record how long after the server stamped a click its client got focus.
+ * Server time and ours only differ by an offset, the smallest one seen
+ * stands in for zero delay, so this is a lower bound. */
+void clickfocused(Time t) {
+	uint32_t offset = (uint32_t)nowms() - (uint32_t)t;
+	if (!clicklatency.n || offset < clicklatency.skew)
+		clicklatency.skew = offset;
+	unsigned long ms = offset - clicklatency.skew;
+	clicklatency.n++;
+	clicklatency.total += ms;
+	clicklatency.max = MAX(clicklatency.max, ms);
+}
+
 /* function implementations */
 
 void applyrules(Client* c) {
-	XClassHint ch = { NULL, NULL };
-
 	/* rule matching */
 	c->position = PositionNone;
 	c->tags = 0;
-	XGetClassHint(dpy, c->win, &ch);
-	const char* class = ch.res_class ? ch.res_class : broken;
-	const char* instance = ch.res_name ? ch.res_name : broken;
+	const char* class = c->class;
+	const char* instance = c->instance;
 
 	c->ignorehints = false;
 	for (unsigned int i = 0; i < LENGTH(ignorehintsmatch); ++i) {
@@ -1264,10 +1845,6 @@ void applyrules(Client* c) {
 				c->mon = m;
 		}
 	}
-	if (ch.res_class)
-		XFree(ch.res_class);
-	if (ch.res_name)
-		XFree(ch.res_name);
 	c->tags = c->tags & TAGMASK ? c->tags & TAGMASK : c->mon->tagset[c->mon->seltags];
 }
 
@@ -1405,11 +1982,11 @@ static void autostartexec(void) {
 
 void checkotherwm(void) {
 	xerrorxlib = XSetErrorHandler(xerrorstart);
-	/* this causes an error if some other window manager is running */
+	/* this causes an error if some other window manager is running, the
+	 * sync has seen it by the time it returns */
 	XSelectInput(dpy, DefaultRootWindow(dpy), SubstructureRedirectMask);
 	XSync(dpy, false);
 	XSetErrorHandler(xerror);
-	XSync(dpy, false);
 }
 
 void cleanup(void) {
@@ -1425,12 +2002,21 @@ void cleanup(void) {
 			freeclient(m->stack);
 		}
 	}
+	free(stacking);
+	#ifndef NODRW
+		/* before schemes and bar windows go away under it */
+		stopbar();
+	#endif /* NODRW */
 	XUngrabKey(dpy, AnyKey, AnyModifier, root);
 	while (mons)
 		cleanupmon(mons);
 	for (size_t i = 0; i < LENGTH(colors); i++)
 		free(scheme[i]);
 	free(scheme);
+	#ifndef NODRW
+		stopiconworker();
+		saveiconcache();
+	#endif /* NODRW */
 	XDestroyWindow(dpy, wmcheckwin);
 	#ifndef NODRW
 		drw_free(drw);
@@ -1455,8 +2041,18 @@ void cleanupmon(Monitor* mon) {
 	free(mon);
 }
 
-void configure(Client* c) {
+/* Tell the client its geometry with a synthetic ConfigureNotify, unless it
+ * already knows it from an earlier one or from the real event of a resize;
+ * ICCCM 4.1.5 wants one for refused requests even so, hence force. */
+void configure(Client* c, bool force) {
 	XConfigureEvent ce;
+	if (!force && c->rx == c->x && c->ry == c->y && c->rw == c->w
+		&& c->rh == c->h && c->rbw == c->bw) {
+		configurestats.skipped++;
+		return;
+	}
+	reported(c);
+	configurestats.sent++;
 	ce.type = ConfigureNotify;
 	ce.display = dpy;
 	ce.event = c->win;
@@ -1471,6 +2067,14 @@ void configure(Client* c) {
 	XSendEvent(dpy, c->win, false, StructureNotifyMask, (XEvent*)&ce);
 }
 
+void reported(Client* c) {
+	c->rx = c->x;
+	c->ry = c->y;
+	c->rw = c->w;
+	c->rh = c->h;
+	c->rbw = c->bw;
+}
+
 Monitor* createmon(void) {
 	Monitor* m = ecalloc(1, sizeof(Monitor));
 	m->tagset[0] = m->tagset[1] = 1;
@@ -1525,193 +2129,517 @@ Monitor* dirtomon(int dir) {
 
 #ifndef NODRW
 	void buttonbar(XButtonPressedEvent* ev, Arg* arg, unsigned int* click) {
-		Monitor* m = selmon;
-		int x = 0, w, tw = 0;
-
-		for (unsigned int i = 0; i < LENGTH(tags); i++) {
-			const int mask = 1 << i;
-			const bool sel = m->tagset[m->seltags] & mask;
-			if (hideemptytags && !sel) {
-				bool haswindow = false;
-				for (Client* c = m->clients; c; c = c->next) {
-					if (c->tags & mask) {
-						haswindow = true;
-						break;
+		/* look the click up in what the bar thread last put on screen */
+		unsigned int lo, hi, mid;
+		Window win = None;
+
+		*click = ClkStatusText;
+		pthread_mutex_lock(&hitlock);
+		for (lo = 0; lo < nhits && hits[lo].bar != ev->window; lo++);
+		for (hi = lo; hi < nhits && hits[hi].bar == ev->window; hi++);
+		while (lo < hi) {
+			mid = lo + (hi - lo) / 2;
+			if (ev->x < hits[mid].x) {
+				hi = mid;
+			} else if (ev->x >= hits[mid].x + hits[mid].w) {
+				lo = mid + 1;
+			} else {
+				*click = hits[mid].click;
+				*arg = hits[mid].arg;
+				win = hits[mid].win;
+				break;
+			}
+		}
+		pthread_mutex_unlock(&hitlock);
+		/* titles name windows, the client may be gone by now */
+		if (win)
+			arg->v = wintoclient(win);
+	}
+
+	void drawbars(void) {
+		barsdirty = true;
+	}
+
+	/* Copy what every bar shows into a free frame and hand it to the bar
+	 * thread. Clients and monitors stay private to the main thread. */
+	void publishbars(void) {
+		BarFrame* f = &frames[framefill];
+		BarState* b;
+		BarTitle* t;
+		Monitor* m;
+		Client* c, * prev;
+		unsigned int i, n, k, sel, first, shown;
+
+		barsdirty = false;
+		++drawtick;
+		f->nbars = f->ntitles = 0;
+		strcpy(f->status, stext);
+		for (m = mons; m; m = m->next) {
+			if (!m->showbar)
+				continue;
+			if (f->nbars == f->barcap) {
+				f->barcap = MAX(4, f->barcap * 2);
+				f->bars = erealloc(f->bars, f->barcap * sizeof(BarState));
+			}
+			b = &f->bars[f->nbars++];
+			b->win = m->barwin;
+			b->bw = m->bw;
+			b->bh = m->bh;
+			b->exposed = m->exposed;
+			b->status = m == selmon; /* status is only drawn on selected monitor */
+
+			for (i = 0; i < LENGTH(tags); i++) {
+				b->tags[i].sel = m->tagset[m->seltags] & 1 << i;
+				for (b->tags[i].n = 0, b->tags[i].seln = -1, c = m->clients; c; c = c->next) {
+					if (c->tags & 1 << i) {
+						if (selmon->sel == c)
+							b->tags[i].seln = b->tags[i].n;
+						b->tags[i].n++;
 					}
 				}
-				if (!haswindow)
+			}
+			b->lt = m->lt[m->sellt]->symbol[0] ? m->lt[m->sellt] - layouts : -1;
+
+			for (n = 0, sel = 0, c = m->clients; c; c = c->next) {
+				if (!ISVISIBLE(c))
 					continue;
+				if (c == m->sel)
+					sel = n;
+				++n;
 			}
-			tw = TEXTW(tags[i]) + textpad * 2;
-			if (tw < m->bh) tw = m->bh;
-			x += tw;
-			if (ev->x < x) {
-				*click = ClkTagBar;
-				arg->ui = 1 << i;
-				return;
+			/* past titlemax only a window of titles around the selected
+			 * client is drawn, between counters of those scrolled off */
+			first = 0;
+			shown = n;
+			if (titlemax && n > titlemax) {
+				shown = titlemax;
+				first = sel > shown / 2 ? MIN(sel - shown / 2, n - shown) : 0;
+			}
+			for (prev = NULL, k = 0, c = m->clients; c; c = c->next) {
+				if (!ISVISIBLE(c))
+					continue;
+				if (k++ == first)
+					break;
+				prev = c;
+			}
+			b->hidden[0] = first;
+			b->hiddenwin[0] = prev ? prev->win : None;
+			b->title = f->ntitles;
+			b->ntitles = shown;
+			if (f->ntitles + shown > f->titlecap) {
+				f->titlecap = MAX(f->titlecap * 2, f->ntitles + shown);
+				f->titles = erealloc(f->titles, f->titlecap * sizeof(BarTitle));
+			}
+			for (k = 0; c && k < shown; c = c->next) {
+				if (!ISVISIBLE(c))
+					continue;
+				++k;
+				if (c->iconstale) {
+					c->iconstale = false;
+					updateicon(c);
+				}
+				t = &f->titles[f->ntitles++];
+				strcpy(t->name, c->name);
+				t->win = c->win;
+				t->icon = c->icon ? c->icon->pic : None;
+				t->icw = c->icon ? c->icon->w : 0;
+				t->ich = c->icon ? c->icon->h : 0;
+				t->iconhash = c->icon ? c->icon->hash : 0;
+				t->sel = m == selmon && m->sel == c;
+				t->pending = c->iconpending;
+				t->ontop = c->isalwaysontop;
+				if (c->icon)
+					c->icon->drawn = drawtick;
 			}
+			for (; c && !ISVISIBLE(c); c = c->next);
+			b->hidden[1] = n - first - shown;
+			b->hiddenwin[1] = c ? c->win : None;
 		}
+		reappictures();
+		f->seq = ++frameseq;
+		/* pictures and windows in the frame must exist before the bar
+		 * connection refers to them, a flush does not order the two
+		 * connections, only a round trip does */
+		if (barsync)
+			XSync(dpy, false);
+		else
+			XFlush(dpy);
+		barsync = false;
+		framefill = __atomic_exchange_n(&framelatest, framefill | FRAMEFRESH, __ATOMIC_ACQ_REL) & 3;
+		sem_post(&barsem);
+	}
 
-		if (m->lt[m->sellt]->symbol[0]) {
-			tw = TEXTW(m->lt[m->sellt]->symbol) + textpad * 2;
-			x += tw;
-			if (ev->x < x) {
-				*click = ClkLtSymbol;
-				return;
-			}
+	/* Free a picture once the bar thread is past every frame that may
+	 * still composite it. */
+	void freepicture(Picture pic) {
+		if (!barrunning) {
+			XRenderFreePicture(dpy, pic);
+			return;
 		}
+		if (ngraves == gravecap) {
+			gravecap = MAX(16, gravecap * 2);
+			graves = erealloc(graves, gravecap * sizeof(*graves));
+		}
+		graves[ngraves].pic = pic;
+		graves[ngraves++].seq = frameseq;
+	}
 
-		w = m->bw - x;
+	void reappictures(void) {
+		unsigned long done = barrunning ? __atomic_load_n(&bardone, __ATOMIC_ACQUIRE) : ULONG_MAX;
+		unsigned int i, n;
 
-		if (m == selmon) { /* status is only drawn on selected monitor */
-			tw = TEXTW(stext) + textpad * 2;
-			if (tw > w) tw = w;
-			if (ev->x > m->bx + m->bw - tw) {
-				*click = ClkStatusText;
-				return;
-			}
-			w -= tw;
+		for (i = n = 0; i < ngraves; i++) {
+			if (graves[i].seq <= done)
+				XRenderFreePicture(dpy, graves[i].pic);
+			else
+				graves[n++] = graves[i];
 		}
-		
-		if (w > 0) {
-			int n = 0;
-			for (Client* c = m->clients; c; c = c->next) {
-				if (ISVISIBLE(c))
-					n++;
-			}
-			if (n > 0) {
-				for (Client* c = m->clients; c; c = c->next) {
-					if (!ISVISIBLE(c))
-						continue;
-					x += w / n;
-					if (ev->x < x) {
-						*click = ClkWinTitle;
-						arg->v = (const void*)c;
-						return;
-					}
-				}
-			}
+		ngraves = n;
+	}
+
+	void openbar(void) {
+		XVisualInfo tpl = { .visualid = XVisualIDFromVisual(visual) }, * vi;
+		int n;
+
+		if (!(bardpy = XOpenDisplay(NULL)))
+			die("dwm: cannot open bar display");
+		/* Visual pointers belong to the connection they came from */
+		if (!(vi = XGetVisualInfo(bardpy, VisualIDMask, &tpl, &n)))
+			die("dwm: bar visual not found");
+		bardrw = drw_create(bardpy, screen, root, vi->visual, depth, cmap);
+		XFree(vi);
+		if (!drw_fontset_create(bardrw, fonts, LENGTH(fonts)))
+			die("no fonts could be loaded.");
+		textpad = bardrw->fonts->h / 2;
+		bh = bardrw->fonts->h * 1.5;
+		scheme = ecalloc(LENGTH(colors), sizeof(Clr*));
+		for (size_t i = 0; i < LENGTH(colors); ++i)
+			scheme[i] = drw_scm_create(bardrw, colors[i], alphas[i], 3);
+	}
+
+	void* openbarasync(void* arg) {
+		(void)arg;
+		openbar();
+		return NULL;
+	}
+
+	void startbar(void) {
+		sigset_t all, old;
+
+		sem_init(&barsem, 0, 0);
+		/* signals are for the main thread only */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		if (pthread_create(&barthread, NULL, barloop, NULL))
+			die("dwm: cannot start bar thread");
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+		barrunning = true;
+	}
+
+	void stopbar(void) {
+		if (barrunning) {
+			__atomic_store_n(&barquit, true, __ATOMIC_RELEASE);
+			sem_post(&barsem);
+			pthread_join(barthread, NULL);
+			sem_destroy(&barsem);
+			barrunning = false;
 		}
-		*click = ClkStatusText;
+		reappictures();
+		free(graves);
+		for (unsigned int i = 0; i < nbarctxs; i++) {
+			drw_surface_free(bardrw, barctxs[i].srf);
+			free(barctxs[i].segs);
+		}
+		free(barctxs);
+		free(hits);
+		for (unsigned int i = 0; i < LENGTH(frames); i++) {
+			free(frames[i].bars);
+			free(frames[i].titles);
+		}
+		drw_surface_free(bardrw, atlas);
+		drw_free(bardrw);
+		XCloseDisplay(bardpy);
 	}
 
-	void drawbar(Monitor* m) {
-		int indn;
-		int x = 0, w, tw = 0, ew = 0, iw = 0;
-		Client* c;
+	/* everything below runs on the bar thread */
 
-		if (!m->showbar)
-			return;
+	void* barloop(void* arg) {
+		(void)arg;
+		for (;;) {
+			sem_wait(&barsem);
+			if (__atomic_load_n(&barquit, __ATOMIC_ACQUIRE))
+				break;
+			/* several posts may have been coalesced into one frame */
+			if (!(__atomic_load_n(&framelatest, __ATOMIC_ACQUIRE) & FRAMEFRESH))
+				continue;
+			framedraw = __atomic_exchange_n(&framelatest, framedraw, __ATOMIC_ACQ_REL) & 3;
+			renderframe(&frames[framedraw]);
+			/* renderframe() syncs, the bars are on screen */
+			if (!__atomic_load_n(&bardone, __ATOMIC_ACQUIRE))
+				tracephase("bars");
+			__atomic_store_n(&bardone, frames[framedraw].seq, __ATOMIC_RELEASE);
+		}
+		return NULL;
+	}
 
-		for (unsigned int i = 0; i < LENGTH(tags); i++) {
-			const int mask = 1 << i;
-			const bool sel = m->tagset[m->seltags] & mask;
-			if (hideemptytags && !sel) {
-				bool haswindow = false;
-				for (c = m->clients; c; c = c->next) {
-					if (c->tags & mask) {
-						haswindow = true;
-						break;
-					}
-				}
-				if (!haswindow)
-					continue;
+	void renderframe(const BarFrame* f) {
+		static char status[sizeof(stext)];
+		unsigned int i, j, n;
+		BarCtx* ctx;
+
+		if (strcmp(status, f->status)) {
+			strcpy(status, f->status);
+			stextw = TEXTW(status) + textpad * 2;
+		}
+		for (i = 0; i < nbarctxs; i++)
+			barctxs[i].live = false;
+		for (i = 0; i < f->nbars; i++) {
+			for (j = 0; j < nbarctxs && barctxs[j].win != f->bars[i].win; j++);
+			if (j == nbarctxs) {
+				barctxs = erealloc(barctxs, ++nbarctxs * sizeof(BarCtx));
+				memset(&barctxs[j], 0, sizeof(BarCtx));
+				barctxs[j].win = f->bars[i].win;
 			}
-			drw_setscheme(drw, scheme[sel ? SchemeSel : SchemeNorm]);
-			tw = TEXTW(tags[i]) + textpad * 2;
-			if (tw < m->bh) {
-				drw_text(drw, x, 0, m->bh, m->bh, (m->bh - tw) / 2 + textpad, tags[i], false);
-				tw = m->bh;
+			renderbar(&barctxs[j], f, &f->bars[i]);
+			/* draw it whole once more if part of it failed */
+			if (barctxs[j].stale)
+				renderbar(&barctxs[j], f, &f->bars[i]);
+			barctxs[j].live = true;
+		}
+		/* bars of removed or hidden monitors */
+		for (i = j = 0; i < nbarctxs; i++) {
+			if (barctxs[i].live) {
+				barctxs[j++] = barctxs[i];
 			} else {
-				drw_text(drw, x, 0, tw, m->bh, textpad, tags[i], false);
+				drw_surface_free(bardrw, barctxs[i].srf);
+				free(barctxs[i].segs);
 			}
-			for (indn = 0, c = m->clients; c; c = c->next) {
-				if (c->tags & mask) {
-					drw_rect(drw, x + 1 + (indn * 4), m->bh - 4, 3, 3, selmon->sel == c, false);
-					indn++;
+		}
+		nbarctxs = j;
+
+		pthread_mutex_lock(&hitlock);
+		for (i = n = 0; i < nbarctxs; i++)
+			n += barctxs[i].nsegs;
+		if (n > hitcap) {
+			hitcap = n;
+			hits = erealloc(hits, hitcap * sizeof(BarSeg));
+		}
+		for (i = nhits = 0, ctx = barctxs; i < nbarctxs; i++, ctx++) {
+			memcpy(hits + nhits, ctx->segs, ctx->nsegs * sizeof(BarSeg));
+			nhits += ctx->nsegs;
+		}
+		pthread_mutex_unlock(&hitlock);
+	}
+
+	bool barseg(BarCtx* ctx, unsigned int n, int x, int w, uint64_t hash, unsigned int click, Arg arg, Window win) {
+		BarSeg* seg;
+
+		if (n >= ctx->segcap) {
+			ctx->segcap = MAX(16, ctx->segcap * 2);
+			ctx->segs = erealloc(ctx->segs, ctx->segcap * sizeof(BarSeg));
+		}
+		seg = &ctx->segs[n];
+		/* segments past the previous count have never been drawn */
+		seg->dirty = ctx->stale || n >= ctx->nsegs || seg->x != x || seg->w != w || seg->hash != hash;
+		seg->bar = ctx->win;
+		seg->x = x;
+		seg->w = w;
+		seg->hash = hash;
+		seg->click = click;
+		seg->arg = arg;
+		seg->win = win;
+		return seg->dirty;
+	}
+
+	void renderbar(BarCtx* ctx, const BarFrame* f, const BarState* b) {
+		static XRectangle* dots;
+		static unsigned int dotcap;
+		int indn, seln, scm;
+		int x = 0, w, tw = 0, ew = 0, iw = 0, stw = 0, lw = 0, rw = 0;
+		unsigned int i, j, k, ndots, nseg = 0;
+		char left[16], right[16];
+		const BarTitle* t;
+		uint64_t h;
+
+		if (!ctx->srf) {
+			ctx->srf = drw_surface_create(bardrw, b->bw, b->bh);
+		} else if (ctx->srf->w != (unsigned int)b->bw || ctx->srf->h != (unsigned int)b->bh) {
+			drw_surface_resize(bardrw, ctx->srf, b->bw, b->bh);
+			ctx->nsegs = 0; /* retained contents no longer match the window */
+		}
+		drw_setsurface(bardrw, ctx->srf);
+		drw_record(bardrw);
+
+		for (i = 0; i < LENGTH(tags); i++) {
+			const bool sel = b->tags[i].sel;
+			indn = b->tags[i].n;
+			seln = b->tags[i].seln;
+			if (hideemptytags && !sel && !indn)
+				continue;
+			h = fnv1a(&i, sizeof(i), FNV1A_INIT);
+			h = fnv1a(&sel, sizeof(sel), h);
+			h = fnv1a(&indn, sizeof(indn), h);
+			h = fnv1a(&seln, sizeof(seln), h);
+			if (barseg(ctx, nseg++, x, tagw[i], h, ClkTagBar, (Arg){ .ui = 1 << i }, None)) {
+				drw_setscheme(bardrw, scheme[sel ? SchemeSel : SchemeNorm]);
+				drw_copy(bardrw, atlas, tagx[i], sel ? bh : 0, x, 0, tagw[i], b->bh);
+				/* only the indicators which fit, anything else would bleed into the next segment */
+				if ((unsigned int)tagw[i] / 4 > dotcap) {
+					dotcap = tagw[i] / 4;
+					dots = erealloc(dots, dotcap * sizeof(XRectangle));
 				}
+				for (ndots = 0, k = 0; (int)k < indn && k * 4 + 4 <= (unsigned int)tagw[i]; k++)
+					if ((int)k != seln)
+						dots[ndots++] = (XRectangle){ x + 1 + k * 4, b->bh - 4, 2, 2 };
+				drw_rects(bardrw, dots, ndots, false, false);
+				if (seln >= 0 && seln * 4 + 4 <= tagw[i])
+					drw_rect(bardrw, x + 1 + seln * 4, b->bh - 4, 3, 3, true, false);
 			}
-			x += tw;
+			x += tagw[i];
 		}
 
-		if (m->lt[m->sellt]->symbol[0]) {
-			drw_setscheme(drw, scheme[SchemeNorm]);
-			tw = TEXTW(m->lt[m->sellt]->symbol);
-			x = drw_text(drw, x, 0, bh, m->bh, (bh - tw) / 2, m->lt[m->sellt]->symbol, false);
+		if (b->lt >= 0) {
+			h = fnv1a(layouts[b->lt].symbol, strlen(layouts[b->lt].symbol), FNV1A_INIT);
+			if (barseg(ctx, nseg++, x, bh, h, ClkLtSymbol, (Arg){ 0 }, None))
+				drw_copy(bardrw, atlas, ltx[b->lt], 0, x, 0, bh, b->bh);
+			x += bh;
 		}
 
-		w = m->bw - x;
+		w = b->bw - x;
 
-		if (m == selmon && w > 0) { /* status is only drawn on selected monitor */
-			drw_setscheme(drw, scheme[SchemeNorm]);
-			tw = TEXTW(stext) + textpad * 2;
-			if (tw > w) tw = w;
-			drw_text(drw, m->bw - tw, 0, tw, m->bh, textpad, stext, false);
-			w -= tw;
+		if (b->status && w > 0) {
+			stw = MIN(stextw, w);
+			w -= stw;
 		}
 
-		if (w > 0) {
-			unsigned int n;
-			for (n = 0, c = m->clients; c; c = c->next) {
-				if (ISVISIBLE(c))
-					++n;
+		if (w > 0 && b->ntitles > 0) {
+			if (b->hidden[0] || b->hidden[1]) {
+				snprintf(left, sizeof(left), "+%u", b->hidden[0]);
+				snprintf(right, sizeof(right), "+%u", b->hidden[1]);
+				lw = b->hidden[0] ? (int)TEXTW(left) + 2 * textpad : 0;
+				rw = b->hidden[1] ? (int)TEXTW(right) + 2 * textpad : 0;
+				/* the titles come first if there is no room for both */
+				if (lw + rw + (int)b->ntitles > w)
+					lw = rw = 0;
 			}
-			if (n > 0) {
-				for (c = m->clients; c; c = c->next) {
-					if (!ISVISIBLE(c))
-						continue;
-					ew = w / n;
-					drw_setscheme(drw, scheme[m == selmon && m->sel == c ? SchemeSel : SchemeNorm]);
-					if (c->icon) {
-						iw = c->icw;
-						if (iw > ew * 1.2) iw = 0;
-					} else {
-						iw = 0;
-					}
-					if (c->name[0] != 0) {
-						tw = TEXTW(c->name) - iw;
-						tw = MIN(tw, ew - iw - textpad * 2);
-						if (tw < 0) tw = 0;
-					} else {
-						tw = 0;
-					}
-					if (tw && iw) {
-						if (tw < ew - 2 * iw - 4 * textpad) {
-							drw_text(drw, x, 0, ew, m->bh, (ew - tw) / 2, c->name, false);
-							drw_pic(drw, x + textpad, (m->bh - c->ich) / 2, c->icw, c->ich, c->icon);
-						} else {
-							drw_rect(drw, x, 0, iw + 2 * textpad, m->bh, true, true);
-							drw_pic(drw, x + textpad, (m->bh - c->ich) / 2, c->icw, c->ich, c->icon);
-							drw_text(drw, x + (iw + 2 * textpad), 0, ew - (iw + 2 * textpad), m->bh, 0, c->name, false);
-						}
-					} else if (iw) {
-						drw_rect(drw, x, 0, ew, m->bh, true, true);
-						if (iw > ew)
-							drw_pic(drw, x, (m->bh - c->ich) / 2, c->icw, c->ich, c->icon);
-						else
-							drw_pic(drw, x + (ew - iw) / 2, (m->bh - c->ich) / 2, c->icw, c->ich, c->icon);
-					} else if (tw) {
-						drw_text(drw, x, 0, ew, m->bh, (ew - tw) / 2, c->name, false);
+			if (lw) {
+				drawcounter(ctx, nseg++, x, lw, left, b->hiddenwin[0], b->bh);
+				x += lw;
+			}
+			ew = (w - lw - rw) / b->ntitles;
+			for (k = 0, t = f->titles + b->title; k < b->ntitles; k++, t++) {
+				scm = t->sel ? SchemeSel : SchemeNorm;
+				h = fnv1a(t->name, strlen(t->name), FNV1A_INIT);
+				h = fnv1a(&scm, sizeof(scm), h);
+				if (t->icon) {
+					h = fnv1a(&t->iconhash, sizeof(t->iconhash), h);
+					h = fnv1a(&t->icw, sizeof(t->icw), h);
+				}
+				h = fnv1a(&t->pending, sizeof(t->pending), h);
+				h = fnv1a(&t->ontop, sizeof(t->ontop), h);
+				if (!barseg(ctx, nseg++, x, ew, h, ClkWinTitle, (Arg){ 0 }, t->win)) {
+					x += ew;
+					continue;
+				}
+				drw_setscheme(bardrw, scheme[scm]);
+				if (t->icon || t->pending) {
+					iw = t->icon ? (int)t->icw : (int)ICONSIZE;
+					if (iw > ew * 1.2) iw = 0;
+				} else {
+					iw = 0;
+				}
+				if (t->name[0] != 0) {
+					tw = TEXTW(t->name) - iw;
+					tw = MIN(tw, ew - iw - textpad * 2);
+					if (tw < 0) tw = 0;
+				} else {
+					tw = 0;
+				}
+				if (tw && iw) {
+					if (tw < ew - 2 * iw - 4 * textpad) {
+						drw_text(bardrw, x, 0, ew, b->bh, (ew - tw) / 2, t->name, false);
+						drawicon(t, x + textpad, b->bh, iw);
 					} else {
-						drw_rect(drw, x, 0, ew, m->bh, true, true);
+						drw_rect(bardrw, x, 0, iw + 2 * textpad, b->bh, true, true);
+						drawicon(t, x + textpad, b->bh, iw);
+						drw_text(bardrw, x + (iw + 2 * textpad), 0, ew - (iw + 2 * textpad), b->bh, 0, t->name, false);
 					}
-					if (c->isalwaysontop) drw_rect(drw, x + 1, true, 4, 4, 0, false);
-					x += ew;
+				} else if (iw) {
+					drw_rect(bardrw, x, 0, ew, b->bh, true, true);
+					if (iw > ew)
+						drawicon(t, x, b->bh, ew);
+					else
+						drawicon(t, x + (ew - iw) / 2, b->bh, iw);
+				} else if (tw) {
+					drw_text(bardrw, x, 0, ew, b->bh, (ew - tw) / 2, t->name, false);
+				} else {
+					drw_rect(bardrw, x, 0, ew, b->bh, true, true);
 				}
-				w -= (w / n) * n;
+				if (t->ontop) drw_rect(bardrw, x + 1, true, 4, 4, 0, false);
+				x += ew;
+			}
+			w -= lw + ew * b->ntitles;
+			if (rw) {
+				drawcounter(ctx, nseg++, x, rw, right, b->hiddenwin[1], b->bh);
+				x += rw;
+				w -= rw;
 			}
 		}
 
-		drw_setscheme(drw, scheme[SchemeNorm]);
-		drw_rect(drw, x, 0, w, m->bh, true, true);
-		drw_map(drw, m->barwin, 0, 0, m->bw, m->bh);
-	}
+		if (w > 0) {
+			if (barseg(ctx, nseg++, x, w, FNV1A_INIT, ClkStatusText, (Arg){ 0 }, None)) {
+				drw_setscheme(bardrw, scheme[SchemeNorm]);
+				drw_rect(bardrw, x, 0, w, b->bh, true, true);
+			}
+			x += w;
+		}
 
-	void drawbars(void) {
-		for (Monitor* m = mons; m; m = m->next)
-			drawbar(m);
-	}
-#endif /* NODRW */
+		if (stw > 0 && barseg(ctx, nseg++, x, stw, fnv1a(f->status, strlen(f->status), FNV1A_INIT), ClkStatusText, (Arg){ 0 }, None)) {
+			drw_setscheme(bardrw, scheme[SchemeNorm]);
+			drw_text(bardrw, x, 0, stw, b->bh, textpad, f->status, false);
+		}
+
+		drw_flush(bardrw);
+
+		/* copy each run of adjacent redrawn segments to the window, or all
+		 * of it if the window lost its contents */
+		ctx->nsegs = nseg;
+		ctx->stale = false;
+		if (b->exposed > ctx->seq) {
+			drw_map(bardrw, ctx->win, 0, 0, b->bw, b->bh);
+		} else {
+			for (i = 0; i < nseg; i = j) {
+				for (j = i + 1; ctx->segs[i].dirty && j < nseg && ctx->segs[j].dirty; j++);
+				if (ctx->segs[i].dirty)
+					drw_map(bardrw, ctx->win, ctx->segs[i].x, 0, ctx->segs[j - 1].x + ctx->segs[j - 1].w - ctx->segs[i].x, b->bh);
+			}
+		}
+		ctx->seq = f->seq;
+		/* drw_map() syncs, so errors of this bar have arrived by now */
+		if (barerror) {
+			barerror = false;
+			ctx->stale = true;
+		}
+	}
+
+	/* "+N" for titles scrolled off the bar, clicks reach win through
+	 * ClkWinCounter so that title bindings never act on a hidden client */
+	void drawcounter(BarCtx* ctx, unsigned int n, int x, int w, const char* label, Window win, int barh) {
+		if (barseg(ctx, n, x, w, fnv1a(label, strlen(label), FNV1A_INIT), ClkWinCounter, (Arg){ 0 }, win)) {
+			drw_setscheme(bardrw, scheme[SchemeNorm]);
+			drw_text(bardrw, x, 0, w, barh, textpad, label, false);
+		}
+	}
+
+	void drawicon(const BarTitle* t, int x, unsigned int barh, unsigned int w) {
+		unsigned int h = t->icon ? t->ich : (unsigned int)ICONSIZE;
+
+		if (t->icon)
+			drw_pic(bardrw, x, (barh - h) / 2, w, h, t->icon);
+		else /* placeholder while the worker loads it */
+			drw_rect(bardrw, x, (barh - h) / 2, w, h, false, false);
+	}
+#endif /* NODRW */
 
 void focus(Client* c) {
 	if (!c || !ISVISIBLE(c))
@@ -1739,7 +2667,7 @@ void focus(Client* c) {
 		#else
 			XSetInputFocus(dpy, selmon->barwin, RevertToPointerRoot, CurrentTime);
 		#endif /* NODRW */
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		setactive(None);
 		selmon->sel = NULL;
 	}
 	#ifndef NODRW
@@ -1780,56 +2708,79 @@ Atom getatomprop(Client* c, Atom prop) {
 	return atom;
 }
 
-unsigned int prealpha(unsigned int p) {
-	unsigned char a = p >> 24u;
-	unsigned int rb = (a * (p & 0xFF00FFu)) >> 8u;
-	unsigned int g = (a * (p & 0x00FF00u)) >> 8u;
-	return (rb & 0xFF00FFu) | (g & 0x00FF00u) | (a << 24u);
-}
-
 int getrootptr(int* x, int* y) {
 	return XQueryPointer(dpy, root, (Window*)dummyptr, (Window*)dummyptr, x, y, (int*)dummyptr, (int*)dummyptr, (unsigned int*)dummyptr);
 }
 
-unsigned long getstate(Window w) {
-	int format;
-	unsigned long result = -1;
-	unsigned char* p = NULL;
-	unsigned long n, extra;
-	Atom real;
-	if (XGetWindowProperty(dpy, w, wmatom[WMState], 0L, 2L, false, wmatom[WMState],
-		&real, &format, &n, &extra, &p) != Success)
-		return -1;
-	if (n != 0 && format == 32)
-		result = *p;
-	XFree(p);
-	return result;
-}
-
 int gettextprop(Window w, Atom atom, char* text, unsigned int size) {
-	char** list = NULL;
-	int n;
 	XTextProperty name;
 	if (!text || size == 0)
 		return 0;
 	text[0] = '\0';
 	if (!XGetTextProperty(dpy, w, &name, atom) || !name.nitems)
 		return 0;
-	if (name.encoding == XA_STRING) {
-		strncpy(text, (char*)name.value, size - 1);
-	} else if (XmbTextPropertyToTextList(dpy, &name, &list, &n) >= Success && n > 0 && *list) {
+	copytextprop(&name, text, size);
+	XFree(name.value);
+	return 1;
+}
+
+void copytextprop(const XTextProperty* prop, char* text, unsigned int size) {
+	char** list = NULL;
+	int n;
+	if (prop->encoding == XA_STRING || prop->encoding == utf8string) {
+		n = MIN(size - 1, prop->nitems);
+		memcpy(text, prop->value, n);
+		if (prop->encoding == utf8string && prop->nitems > size - 1)
+			n = utf8trim(text, n);
+		text[n] = '\0';
+	} else if (XmbTextPropertyToTextList(dpy, (XTextProperty*)prop, &list, &n) >= Success && n > 0 && *list) {
 		strncpy(text, *list, size - 1);
 		XFreeStringList(list);
 	}
 	text[size - 1] = '\0';
-	XFree(name.value);
-	return 1;
+}
+
+/* UTF8_STRING properties as they are, fetching only what fits in text */
+int getutf8prop(Window w, Atom atom, char* text, unsigned int size) {
+	int format;
+	unsigned long n, after;
+	unsigned char* p = NULL;
+	Atom type;
+
+	if (XGetWindowProperty(dpy, w, atom, 0L, size / 4, False, utf8string,
+		&type, &format, &n, &after, &p) != Success || !p)
+		return 0;
+	if (type == utf8string && format == 8 && n > 0) {
+		if (after || n > size - 1) {
+			n = MIN(n, size - 1);
+			n = utf8trim((char*)p, n);
+		}
+		memcpy(text, p, n);
+		text[n] = '\0';
+	} else
+		n = 0;
+	XFree(p);
+	return n > 0;
+}
+
+/* len without a multibyte sequence cut off at its end */
+unsigned int utf8trim(const char* s, unsigned int len) {
+	unsigned int i = len, need;
+	unsigned char lead;
+
+	while (i > 0 && (s[i - 1] & 0xC0) == 0x80)
+		i--;
+	if (i == 0)
+		return 0;
+	lead = s[i - 1];
+	need = lead >= 0xF0 ? 4 : lead >= 0xE0 ? 3 : lead >= 0xC0 ? 2 : 1;
+	return len - (i - 1) < need ? i - 1 : len;
 }
 
 void grabbuttons(Client* c, bool focused) {
 	updatenumlockmask();
 	XUngrabButton(dpy, AnyButton, AnyModifier, c->win);
-	if (!focused)
+	if (!focused && !xiclick) /* freezes the pointer until eventbuttonpress */
 		XGrabButton(dpy, AnyButton, AnyModifier, c->win, false,
 			BUTTONMASK, GrabModeSync, GrabModeSync, None, None);
 	for (unsigned int i = 0; i < LENGTH(buttons); i++)
@@ -1864,7 +2815,7 @@ void grabkeys(void) {
 
 void killclient(Client* c) {
 	if (!c) return;
-	if (!sendevent(c, wmatom[WMDelete])) {
+	if (!sendevent(c, WMDelete)) {
 		XGrabServer(dpy);
 		XSetErrorHandler(xerrordummy);
 		XSetCloseDownMode(dpy, DestroyAll);
@@ -1885,9 +2836,29 @@ void killclient(Client* c) {
 	}
 #endif /* XINERAMA */
 
-Client* manage(Window w, XWindowAttributes* wa) {
+Client* manage(Window w, XWindowAttributes* wa, Prefetch* pf) {
+	Client* c = adopt(w, wa, pf);
+	ewmhdirty |= EwmhClientList;
+	focus(c);
+	arrange(c->mon);
+	XMapWindow(dpy, c->win);
+	setfocus(c);
+	return c;
+}
+
+/* the part of manage() that is per window, scan() adopts many before
+ * arranging and focusing once */
+Client* adopt(Window w, XWindowAttributes* wa, Prefetch* pf) {
 	Client* c = ecalloc(1, sizeof(Client));
+	xcb_get_property_reply_t** r = pf->reply;
+	const uint32_t* v;
+	unsigned long now = nowms();
 	c->win = w;
+	for (int i = 0; i < RateLast; i++) {
+		c->tokens[i] = rateburst;
+		c->refilled[i] = now;
+	}
+	c->mapreq = pf->mapreq;
 	/* geometry */
 	c->x = c->oldx = wa->x;
 	c->y = c->oldy = wa->y;
@@ -1896,14 +2867,32 @@ Client* manage(Window w, XWindowAttributes* wa) {
 	c->oldbw = c->bw = borderwidth;
 
 	#ifndef NODRW
-		updateicon(c);
+		c->iconstale = true;
 	#endif /* NODRW */
-	updatetitle(c);
+	collectprefetch(pf);
+	if (!(c->hasnetname = proptext(r[PropNetName], c->name, sizeof c->name)))
+		proptext(r[PropName], c->name, sizeof c->name);
+	if (c->name[0] == '\0') /* hack to mark broken clients */
+		strcpy(c->name, broken);
+	if (r[PropClass] && r[PropClass]->type == XA_STRING && r[PropClass]->format == 8) {
+		char buf[256 + 1]; /* "instance\0class\0" */
+		int n = MIN(r[PropClass]->value_len, 256);
+		memcpy(buf, xcb_get_property_value(r[PropClass]), n);
+		buf[n] = '\0';
+		int len = strlen(buf);
+		setclass(c, buf, len < n ? buf + len + 1 : NULL);
+	} else
+		setclass(c, NULL, NULL);
+	if ((v = propitems(r[PropProtocols], XA_ATOM, 1)))
+		for (int i = r[PropProtocols]->value_len; i--; )
+			c->protocols |= protocolbit(v[i]);
+	c->winstate = (v = propitems(r[PropState], XA_ATOM, 1)) ? v[0] : None;
+	c->wintype = (v = propitems(r[PropType], XA_ATOM, 1)) ? v[0] : None;
 
 	Client* t = NULL;
-	Window trans = None;
+	Window trans = (v = propitems(r[PropTrans], XA_WINDOW, 1)) ? v[0] : None;
 	XWindowChanges wc;
-	if (XGetTransientForHint(dpy, w, &trans) && (t = wintoclient(trans))) {
+	if (trans != None && (t = wintoclient(trans))) {
 		c->mon = t->mon;
 		c->tags = t->tags;
 	} else {
@@ -1921,27 +2910,56 @@ Client* manage(Window w, XWindowAttributes* wa) {
 	wc.border_width = c->bw;
 	XConfigureWindow(dpy, w, CWBorderWidth, &wc);
 	XSetWindowBorder(dpy, w, scheme[SchemeNorm][ColBorder].pixel);
-	configure(c); /* propagates border_width, if size doesn't change */
+	configure(c, false); /* propagates border_width, if size doesn't change */
 	updatewindowtype(c);
-	updatesizehints(c);
-	updatewmhints(c);
-	XSelectInput(dpy, w, EnterWindowMask | FocusChangeMask | PropertyChangeMask | StructureNotifyMask);
+	if (!c->ignorehints) {
+		XSizeHints size = { .flags = PSize };
+		if ((v = propitems(r[PropNormalHints], XA_WM_SIZE_HINTS, 15))) {
+			/* ICCCM 4.1.2.3 layout, pre-ICCR clients stop before the base size */
+			size.flags = v[0] & (USPosition | USSize | PAllHints);
+			if (r[PropNormalHints]->value_len < 18)
+				size.flags &= ~(PBaseSize | PWinGravity);
+			size.min_width = v[5];
+			size.min_height = v[6];
+			size.max_width = v[7];
+			size.max_height = v[8];
+			size.width_inc = v[9];
+			size.height_inc = v[10];
+			size.min_aspect.x = v[11];
+			size.min_aspect.y = v[12];
+			size.max_aspect.x = v[13];
+			size.max_aspect.y = v[14];
+			if (size.flags & PBaseSize) {
+				size.base_width = v[15];
+				size.base_height = v[16];
+			}
+		}
+		setsizehints(c, &size);
+	}
+	if ((v = propitems(r[PropHints], XA_WM_HINTS, 8))) {
+		XWMHints wmh = {
+			.flags = v[0], .input = v[1], .initial_state = v[2],
+			.icon_pixmap = v[3], .icon_window = v[4], .icon_x = v[5], .icon_y = v[6],
+			.icon_mask = v[7],
+			.window_group = r[PropHints]->value_len >= 9 ? v[8] : None
+		};
+		setwmhints(c, &wmh);
+	} else
+		setwmhints(c, NULL);
+	discardprefetch(pf);
 	grabbuttons(c, false);
 	if (c->position != PositionNone && (trans != None || c->isunresizeable))
 		c->position = PositionNone; /* later applied */
 	if (c->position == PositionNone)
 		XRaiseWindow(dpy, c->win);
+	/* a window is created on top of its siblings and scan() adopts them
+	 * bottom to top, tiled ones are left where the server has them */
+	stacktop(c->win);
 	attach(c);
 	attachstack(c);
-	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32, PropModeAppend,
-		(unsigned char*)&(c->win), true);
 	hideclient(c); /* some windows require this */
 	setclientstate(c, NormalState);
 	c->opacity = -1;
-	focus(c);
-	arrange(c->mon);
-	XMapWindow(dpy, c->win);
-	setfocus(c);
 	return c;
 }
 
@@ -2004,7 +3022,11 @@ void resizeclient(Client* c, int x, int y, int w, int h) {
 	c->oldh = c->h; c->h = wc.height = h;
 	wc.border_width = c->bw;
 	XConfigureWindow(dpy, c->win, CWX | CWY | CWWidth | CWHeight | CWBorderWidth, &wc);
-	configure(c);
+	if (c->w != c->rw || c->h != c->rh) {
+		reported(c); /* by the real ConfigureNotify of the resize */
+		configurestats.skipped++;
+	} else
+		configure(c, false);
 	XSync(dpy, false);
 }
 
@@ -2121,8 +3143,8 @@ void setposition(Client* c, enum Position position, bool force) {
 		arrange(c->mon);
 	} else if (c->oldposition == PositionFullscreen) {
 		c->bw = c->oldbw;
-		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
-			PropModeReplace, (unsigned char*)NULL, false);
+		c->statedirty = true;
+		ewmhdirty |= EwmhState;
 		if (c->position == PositionNone) {
 			resize(c, c->oldx, c->oldy, c->oldw, c->oldh, false);
 			return;
@@ -2130,8 +3152,8 @@ void setposition(Client* c, enum Position position, bool force) {
 	} else if (c->position == PositionFullscreen) {
 		c->oldbw = c->bw;
 		c->bw = 0;
-		XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
-			PropModeReplace, (unsigned char*)&netatom[NetWMFullscreen], true);
+		c->statedirty = true;
+		ewmhdirty |= EwmhState;
 	}
 	setpositionmove(c, position, force);
 }
@@ -2142,48 +3164,248 @@ void restack(Monitor* m) {
 	if (!m->sel) return;
 
 	if (ISVISIBLE(m->sel))
-		XRaiseWindow(dpy, m->sel->win);
+		raiseclient(m->sel);
 	for (c = m->stack; c; c = c->snext)
 		if (ISVISIBLE(c) && c->isalwaysontop)
-			XRaiseWindow(dpy, c->win);
+			raiseclient(c);
 
 	XSync(dpy, false);
 
 	#ifndef NODRW
-		drawbar(m);
+		drawbars();
 	#endif /* NODRW */
 }
 
+void raiseclient(Client* c) {
+	XRaiseWindow(dpy, c->win);
+	stacktop(c->win);
+}
+
+/* Mirror w going to the top of its siblings in the list
+ * _NET_CLIENT_LIST_STACKING is published from. dwm only ever raises, and
+ * client requests for their stacking are not forwarded. */
+void stacktop(Window w) {
+	int i;
+
+	for (i = 0; i < nstacking && stacking[i] != w; i++);
+	if (i == nstacking) {
+		if (nstacking == stackingcap) {
+			stackingcap = MAX(16, stackingcap * 2);
+			stacking = erealloc(stacking, stackingcap * sizeof(*stacking));
+		}
+		nstacking++;
+	} else if (i == nstacking - 1)
+		return;
+	memmove(&stacking[i], &stacking[i + 1], (nstacking - i - 1) * sizeof(*stacking));
+	stacking[nstacking - 1] = w;
+	ewmhdirty |= EwmhStacking;
+}
+
 void run(void) {
 	/* main event loop */
 	XSync(dpy, false);
 	XEvent ev;
-	while (running && !XNextEvent(dpy, &ev))
+	while (running) {
+		/* timers before events, a flood of them must not hold these back */
+		if (deferdue || geomdue) {
+			unsigned long now = nowms();
+			if (deferdue && (long)(deferdue - now) <= 0)
+				applydeferred();
+			if (geomdue && (long)(geomdue - now) <= 0)
+				applygeom();
+		}
+		#ifndef NODRW
+			/* one frame per batch of events, however many changed the bars */
+			if (barsdirty && batchend(&barsdue))
+				publishbars();
+		#endif /* NODRW */
+		if (ewmhdirty && batchend(&ewmhdue))
+			publishewmh();
+		/* sleep until the next event or timer, whichever is first */
+		if ((deferdue || geomdue) && !XPending(dpy)) {
+			unsigned long due = !geomdue ? deferdue : !deferdue ? geomdue : MIN(deferdue, geomdue);
+			long wait = (long)(due - nowms());
+			struct pollfd pfd = { .fd = ConnectionNumber(dpy), .events = POLLIN };
+			if (wait > 0)
+				poll(&pfd, 1, wait);
+			continue;
+		}
+		if (XNextEvent(dpy, &ev))
+			break;
 		eventhandle(&ev);
+		if (dumpstats) {
+			dumpstats = 0;
+			printstats();
+		}
+	}
+}
+
+void printstats(void) {
+	#ifndef NODRW
+		unsigned int n = 0;
+		for (Icon* ic = icons; ic; ic = ic->next)
+			++n;
+		fprintf(stderr, "dwm: icons: %u, %lu KiB, peak %lu KiB, budget %lu KiB\n",
+			n, iconbytes >> 10, iconpeak >> 10, iconbudget >> 10);
+	#endif /* NODRW */
+	fprintf(stderr, "dwm: map request to mapped: %lu windows, avg %lu us, max %lu us\n",
+		maplatency.n, maplatency.n ? maplatency.total / maplatency.n : 0, maplatency.max);
+	fprintf(stderr, "dwm: titles: %lu fetched, %lu unchanged, %lu WM_NAME shadowed by _NET_WM_NAME\n",
+		titlestats.updates, titlestats.unchanged, titlestats.shadowed);
+	fprintf(stderr, "dwm: synthetic ConfigureNotify: %lu sent, %lu skipped\n",
+		configurestats.sent, configurestats.skipped);
+	fprintf(stderr, "dwm: click to focus (%s): %lu clicks, avg %lu ms, max %lu ms\n",
+		xiclick ? "XI2 raw, pointer not frozen" : "sync grab, pointer frozen meanwhile",
+		clicklatency.n, clicklatency.n ? clicklatency.total / clicklatency.n : 0, clicklatency.max);
+	for (Monitor* m = mons; m; m = m->next)
+		for (Client* c = m->clients; c; c = c->next)
+			if (c->limited)
+				fprintf(stderr, "dwm: rate limited 0x%lx (%s): %lu events deferred\n",
+					c->win, c->name, c->limited);
+}
+
+void sigstats(int unused) {
+	(void)unused;
+	dumpstats = 1;
+}
+
+void prefetch(Window w, Prefetch* pf) {
+	const struct { Atom atom; uint32_t len; } props[PropLast] = {
+		[PropNetName] = { netatom[NetWMName], 64 },
+		[PropName] = { XA_WM_NAME, 64 },
+		[PropTrans] = { XA_WM_TRANSIENT_FOR, 1 },
+		[PropClass] = { XA_WM_CLASS, 64 },
+		[PropProtocols] = { wmatom[WMProtocols], 32 },
+		[PropState] = { netatom[NetWMState], 1 },
+		[PropType] = { netatom[NetWMWindowType], 1 },
+		[PropNormalHints] = { XA_WM_NORMAL_HINTS, 18 },
+		[PropHints] = { XA_WM_HINTS, 9 },
+	};
+
+	/* select first so no change slips between these reads and the cache */
+	XSelectInput(dpy, w, EnterWindowMask | FocusChangeMask | PropertyChangeMask | StructureNotifyMask
+		| (xiclick ? LeaveWindowMask : 0));
+	for (int i = 0; i < PropLast; i++)
+		pf->cookie[i] = xcb_get_property(xcon, 0, w, props[i].atom, XCB_GET_PROPERTY_TYPE_ANY, 0, props[i].len);
+	pf->mapreq.tv_sec = pf->mapreq.tv_nsec = 0;
+	pf->collected = false;
+}
+
+/* everything prefetch() asked for, waiting at most one round trip */
+void collectprefetch(Prefetch* pf) {
+	if (pf->collected)
+		return;
+	for (int i = 0; i < PropLast; i++)
+		pf->reply[i] = xcb_get_property_reply(xcon, pf->cookie[i], NULL);
+	pf->collected = true;
+}
+
+void discardprefetch(Prefetch* pf) {
+	for (int i = 0; i < PropLast; i++) {
+		if (pf->collected)
+			free(pf->reply[i]);
+		else
+			xcb_discard_reply(xcon, pf->cookie[i].sequence);
+	}
+}
+
+/* the format 32 items of r if it has the given type and at least min of them */
+const uint32_t* propitems(const xcb_get_property_reply_t* r, Atom type, unsigned int min) {
+	if (!r || r->type != type || r->format != 32 || r->value_len < min)
+		return NULL;
+	return xcb_get_property_value(r);
+}
+
+int proptext(const xcb_get_property_reply_t* r, char* text, unsigned int size) {
+	XTextProperty prop;
+	if (!r || r->type == None || !r->value_len)
+		return 0;
+	prop.value = xcb_get_property_value(r);
+	prop.encoding = r->type;
+	prop.format = r->format;
+	prop.nitems = r->value_len;
+	copytextprop(&prop, text, size);
+	return 1;
 }
 
 void scan(void) {
 	unsigned int num;
 	Window d1, d2;
 	Window* wins = NULL;
-	XWindowAttributes wa;
+	Monitor* m;
+	struct {
+		xcb_get_window_attributes_cookie_t attr;
+		xcb_get_geometry_cookie_t geom;
+		xcb_get_property_cookie_t state;
+		XWindowAttributes wa;
+		Prefetch pf;
+		bool fetched, transient;
+	}* q;
 	if (!XQueryTree(dpy, root, &d1, &d2, &wins, &num)) return;
+	if (num == 0) {
+		XFree(wins);
+		return;
+	}
+	/* attributes of every window in one round trip, then the properties
+	 * of the candidates in another */
+	q = ecalloc(num, sizeof *q);
 	for (unsigned int i = 0; i < num; i++) {
-		if (!XGetWindowAttributes(dpy, wins[i], &wa)
-			|| wa.override_redirect || XGetTransientForHint(dpy, wins[i], &d1))
-			continue;
-		if (wa.map_state == IsViewable) /* || getstate(wins[i]) == IconicState) */
-			manage(wins[i], &wa);
+		q[i].attr = xcb_get_window_attributes(xcon, wins[i]);
+		q[i].geom = xcb_get_geometry(xcon, wins[i]);
+		q[i].state = xcb_get_property(xcon, 0, wins[i], wmatom[WMState], wmatom[WMState], 0, 2);
 	}
-	for (unsigned int i = 0; i < num; i++) { /* now the transients */
-		if (!XGetWindowAttributes(dpy, wins[i], &wa))
+	for (unsigned int i = 0; i < num; i++) {
+		xcb_get_window_attributes_reply_t* a = xcb_get_window_attributes_reply(xcon, q[i].attr, NULL);
+		xcb_get_geometry_reply_t* g = xcb_get_geometry_reply(xcon, q[i].geom, NULL);
+		xcb_get_property_reply_t* st = xcb_get_property_reply(xcon, q[i].state, NULL);
+		const uint32_t* v = propitems(st, wmatom[WMState], 1);
+		if (a && g && !a->override_redirect
+			&& (a->map_state == IsViewable || (v && v[0] == IconicState))) {
+			q[i].wa.x = g->x;
+			q[i].wa.y = g->y;
+			q[i].wa.width = g->width;
+			q[i].wa.height = g->height;
+			q[i].wa.border_width = g->border_width;
+			q[i].wa.map_state = a->map_state;
+			prefetch(wins[i], &q[i].pf);
+			q[i].fetched = true;
+		}
+		free(a);
+		free(g);
+		free(st);
+	}
+	for (unsigned int i = 0; i < num; i++) {
+		if (!q[i].fetched)
 			continue;
-		if (XGetTransientForHint(dpy, wins[i], &d1)
-			&& (wa.map_state == IsViewable || getstate(wins[i]) == IconicState))
-			manage(wins[i], &wa);
+		collectprefetch(&q[i].pf);
+		q[i].transient = propitems(q[i].pf.reply[PropTrans], XA_WINDOW, 1) != NULL;
+		if (!q[i].transient && q[i].wa.map_state != IsViewable) { /* iconic */
+			discardprefetch(&q[i].pf);
+			XSelectInput(dpy, wins[i], NoEventMask);
+			q[i].fetched = false;
+		}
 	}
-	if (wins)
-		XFree(wins);
+	/* transients after the windows they belong to */
+	for (unsigned int i = 0; i < num; i++)
+		if (q[i].fetched && !q[i].transient)
+			adopt(wins[i], &q[i].wa, &q[i].pf);
+	for (unsigned int i = 0; i < num; i++)
+		if (q[i].fetched && q[i].transient)
+			adopt(wins[i], &q[i].wa, &q[i].pf);
+	ewmhdirty |= EwmhClientList;
+	for (m = mons; m; m = m->next)
+		arrange(m);
+	for (unsigned int i = 0; i < num; i++)
+		if (q[i].fetched)
+			XMapWindow(dpy, wins[i]);
+	/* no EnterNotify comes for the window already under the pointer */
+	int di;
+	unsigned int dui;
+	if (xiclick && XQueryPointer(dpy, root, &d1, &d2, &di, &di, &di, &di, &dui))
+		hovered = wintoclient(d2);
+	focus(NULL);
+	free(q);
+	XFree(wins);
 	#ifndef NODRW
 		drawbars();
 	#endif
@@ -2210,23 +3432,16 @@ void setclientstate(Client* c, long state) {
 		PropModeReplace, (unsigned char*)data, 2);
 }
 
-int sendevent(Client* c, Atom proto) {
-	int n;
-	Atom* protocols;
-	int exists = 0;
+int sendevent(Client* c, int proto) {
+	int exists = c->protocols >> proto & 1;
 	XEvent ev;
 
-	if (XGetWMProtocols(dpy, c->win, &protocols, &n)) {
-		while (!exists && n--)
-			exists = protocols[n] == proto;
-		XFree(protocols);
-	}
 	if (exists) {
 		ev.type = ClientMessage;
 		ev.xclient.window = c->win;
 		ev.xclient.message_type = wmatom[WMProtocols];
 		ev.xclient.format = 32;
-		ev.xclient.data.l[0] = proto;
+		ev.xclient.data.l[0] = wmatom[proto];
 		ev.xclient.data.l[1] = CurrentTime;
 		XSendEvent(dpy, c->win, false, NoEventMask, &ev);
 	}
@@ -2236,10 +3451,8 @@ int sendevent(Client* c, Atom proto) {
 void setfocus(Client* c) {
 	if (!c->neverfocus)
 		XSetInputFocus(dpy, c->win, RevertToPointerRoot, CurrentTime);
-	XChangeProperty(dpy, root, netatom[NetActiveWindow],
-		XA_WINDOW, 32, PropModeReplace,
-		(unsigned char*)&(c->win), true);
-	sendevent(c, wmatom[WMTakeFocus]);
+	setactive(c->win);
+	sendevent(c, WMTakeFocus);
 }
 
 void setmaster(Client* master) {
@@ -2252,9 +3465,7 @@ void setmaster(Client* master) {
 
 void setup(void) {
 	XSetWindowAttributes wa;
-	Atom utf8string;
 	struct sigaction sa;
-	int i;
 
 	/* do not transform children into zombies when they terminate */
 	sigemptyset(&sa.sa_mask);
@@ -2265,52 +3476,100 @@ void setup(void) {
 	/* clean up any zombies */
 	while (waitpid(-1, NULL, WNOHANG) > 0) { /* nothing */}
 
+	/* SIGUSR1 prints statistics to stderr after the next event */
+	sa.sa_flags = SA_RESTART;
+	sa.sa_handler = sigstats;
+	sigaction(SIGUSR1, &sa, NULL);
+
 	/* init screen */
 	screen = DefaultScreen(dpy);
 	sw = DisplayWidth(dpy, screen);
 	sh = DisplayHeight(dpy, screen);
 	root = RootWindow(dpy, screen);
+	xcon = XGetXCBConnection(dpy);
 	#ifndef NODRW
 		xinitvisual();
-		drw = drw_create(dpy, screen, root, sw, sh, visual, depth, cmap);
-		if (!drw_fontset_create(drw, fonts, LENGTH(fonts)))
-			die("no fonts could be loaded.");
-		textpad = drw->fonts->h / 2;
-		bh = drw->fonts->h * 1.5;
+		drw = drw_create(dpy, screen, root, visual, depth, cmap);
+		/* fonts and colors load on the bar connection meanwhile */
+		if (pthread_create(&fontthread, NULL, openbarasync, NULL))
+			die("dwm: cannot start font thread");
 	#endif /* NODRW */
-	updategeom();
-	/* init atoms */
-	utf8string = XInternAtom(dpy, "UTF8_STRING", false);
-	wmatom[WMProtocols] = XInternAtom(dpy, "WM_PROTOCOLS", false);
-	wmatom[WMDelete] = XInternAtom(dpy, "WM_DELETE_WINDOW", false);
-	wmatom[WMState] = XInternAtom(dpy, "WM_STATE", false);
-	wmatom[WMTakeFocus] = XInternAtom(dpy, "WM_TAKE_FOCUS", false);
-	netatom[NetActiveWindow] = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", false);
-	netatom[NetClientList] = XInternAtom(dpy, "_NET_CLIENT_LIST", false);
-	netatom[NetWMWindowsOpacity] = XInternAtom(dpy, "_NET_WM_WINDOW_OPACITY", false);
-	netatom[NetSupported] = XInternAtom(dpy, "_NET_SUPPORTED", false);
-	netatom[NetWMName] = XInternAtom(dpy, "_NET_WM_NAME", false);
-	netatom[NetWMIcon] = XInternAtom(dpy, "_NET_WM_ICON", false);
-	netatom[NetWMState] = XInternAtom(dpy, "_NET_WM_STATE", false);
-	netatom[NetWMCheck] = XInternAtom(dpy, "_NET_SUPPORTING_WM_CHECK", false);
-	netatom[NetWMFullscreen] = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", false);
-	netatom[NetWMWindowType] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE", false);
-	netatom[NetWMWindowTypeDialog] = XInternAtom(dpy, "_NET_WM_WINDOW_TYPE_DIALOG", false);
+	/* init atoms, in one round trip */
+	char* names[2 + WMLast + NetLast] = {
+		"UTF8_STRING",
+		[1 + WMProtocols] = "WM_PROTOCOLS",
+		[1 + WMDelete] = "WM_DELETE_WINDOW",
+		[1 + WMState] = "WM_STATE",
+		[1 + WMTakeFocus] = "WM_TAKE_FOCUS",
+		[1 + WMLast + NetActiveWindow] = "_NET_ACTIVE_WINDOW",
+		[1 + WMLast + NetClientList] = "_NET_CLIENT_LIST",
+		[1 + WMLast + NetClientListStacking] = "_NET_CLIENT_LIST_STACKING",
+		[1 + WMLast + NetWMWindowsOpacity] = "_NET_WM_WINDOW_OPACITY",
+		[1 + WMLast + NetSupported] = "_NET_SUPPORTED",
+		[1 + WMLast + NetWMName] = "_NET_WM_NAME",
+		[1 + WMLast + NetWMIcon] = "_NET_WM_ICON",
+		[1 + WMLast + NetWMState] = "_NET_WM_STATE",
+		[1 + WMLast + NetWMCheck] = "_NET_SUPPORTING_WM_CHECK",
+		[1 + WMLast + NetWMFullscreen] = "_NET_WM_STATE_FULLSCREEN",
+		[1 + WMLast + NetWMWindowType] = "_NET_WM_WINDOW_TYPE",
+		[1 + WMLast + NetWMWindowTypeDialog] = "_NET_WM_WINDOW_TYPE_DIALOG",
+		[1 + WMLast + NetLast] = "_DWM_ICON_READY",
+	};
+	Atom atoms[LENGTH(names)];
+	XInternAtoms(dpy, names, LENGTH(names), false, atoms);
+	utf8string = atoms[0];
+	memcpy(wmatom, &atoms[1], sizeof wmatom);
+	memcpy(netatom, &atoms[1 + WMLast], sizeof netatom);
+	#ifndef NODRW
+		iconready = atoms[1 + WMLast + NetLast];
+	#endif /* NODRW */
+	tracephase("atoms");
 	/* init cursors */
 	cursor[CurNormal] = XCreateFontCursor(dpy, XC_left_ptr);
 	cursor[CurResize] = XCreateFontCursor(dpy, XC_sizing);
 	cursor[CurMove] = XCreateFontCursor(dpy, XC_fleur);
-	/* init appearance */
-	scheme = ecalloc(LENGTH(colors), sizeof(Clr*));
-	for (i = 0; i < LENGTH(colors); ++i) {
-		#ifdef NODRW
+	#ifdef NODRW
+		/* init appearance */
+		scheme = ecalloc(LENGTH(colors), sizeof(Clr*));
+		for (size_t i = 0; i < LENGTH(colors); ++i)
 			scheme[i] = drw_scm_create(colors[i], alphas[i], 3);
-		#else
-			scheme[i] = drw_scm_create(drw, colors[i], alphas[i], 3);
-		#endif /* NODRW */
-	}
+	#else
+		pthread_join(fontthread, NULL);
+		tracephase("fonts");
+	#endif /* NODRW */
+	#ifdef XRANDR
+		int rrerror, major = 1, minor = 5;
+		if (XRRQueryExtension(dpy, &randrbase, &rrerror) && XRRQueryVersion(dpy, &major, &minor)
+			&& (major > 1 || minor >= 5)) {
+			userandr = true;
+			XRRSelectInput(dpy, root, RRScreenChangeNotifyMask | RRCrtcChangeNotifyMask | RROutputChangeNotifyMask);
+		}
+	#endif /* XRANDR */
+	#ifdef XINPUT
+		/* raw button presses reach root whatever window is clicked, no grab
+		 * needed, the modifiers held come from Xkb as they change */
+		int xievent, xierror, ximajor = 2, ximinor = 1;
+		int xkbop, xkberror, xkbmajor = XkbMajorVersion, xkbminor = XkbMinorVersion;
+		XkbStateRec xkbstate;
+		if (asyncclickfocus && XQueryExtension(dpy, "XInputExtension", &xiopcode, &xievent, &xierror)
+			&& XIQueryVersion(dpy, &ximajor, &ximinor) == Success
+			&& (ximajor > 2 || ximinor >= 1)
+			&& XkbQueryExtension(dpy, &xkbop, &xkbbase, &xkberror, &xkbmajor, &xkbminor)
+			&& XkbSelectEventDetails(dpy, XkbUseCoreKbd, XkbStateNotify, XkbModifierStateMask, XkbModifierStateMask)
+			&& XkbGetState(dpy, XkbUseCoreKbd, &xkbstate) == Success) {
+			unsigned char mask[XIMaskLen(XI_LASTEVENT)] = { 0 };
+			XIEventMask em = { XIAllMasterDevices, sizeof(mask), mask };
+			XISetMask(mask, XI_RawButtonPress);
+			XISelectEvents(dpy, root, &em, 1);
+			xkbmods = xkbstate.mods;
+			xiclick = true;
+		}
+	#endif /* XINPUT */
+	updategeom();
 	#ifndef NODRW
 		/* init bars */
+		updateatlas();
+		loadiconcache();
 		updatebars();
 		updatestatus();
 	#endif
@@ -2322,10 +3581,15 @@ void setup(void) {
 		PropModeReplace, (unsigned char*)"dwm", 3);
 	XChangeProperty(dpy, root, netatom[NetWMCheck], XA_WINDOW, 32,
 		PropModeReplace, (unsigned char*)&wmcheckwin, true);
+	#ifndef NODRW
+		starticonworker();
+		startbar();
+	#endif /* NODRW */
 	/* EWMH support per view */
 	XChangeProperty(dpy, root, netatom[NetSupported], XA_ATOM, 32,
 		PropModeReplace, (unsigned char*)netatom, NetLast);
 	XDeleteProperty(dpy, root, netatom[NetClientList]);
+	XDeleteProperty(dpy, root, netatom[NetClientListStacking]);
 	/* select events */
 	wa.cursor = cursor[CurNormal];
 	wa.event_mask = SubstructureRedirectMask | SubstructureNotifyMask
@@ -2335,17 +3599,31 @@ void setup(void) {
 	XSelectInput(dpy, root, wa.event_mask);
 	grabkeys();
 	focus(NULL);
+	tracephase("setup");
 }
 
-void seturgent(Client* c, int urg) {
-	XWMHints* wmh;
+/* -T prints the time since main() was entered at each startup phase,
+ * "bars" comes from the bar thread once its first frame is drawn */
+void tracephase(const char* phase) {
+	static unsigned long last;
+	struct timespec now;
+	unsigned long us;
+
+	if (!trace)
+		return;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	us = (now.tv_sec - tracestart.tv_sec) * 1000000 + (now.tv_nsec - tracestart.tv_nsec) / 1000;
+	fprintf(stderr, "dwm: startup %-10s %8lu us (+%lu us)\n", phase, us,
+		us - __atomic_exchange_n(&last, us, __ATOMIC_RELAXED));
+}
 
+void seturgent(Client* c, int urg) {
 	c->isurgent = urg;
-	if (!(wmh = XGetWMHints(dpy, c->win)))
+	if (!c->haswmhints)
 		return;
-	wmh->flags = urg ? (wmh->flags | XUrgencyHint) : (wmh->flags & ~XUrgencyHint);
-	XSetWMHints(dpy, c->win, wmh);
-	XFree(wmh);
+	c->wmhints.flags = urg ? (c->wmhints.flags | XUrgencyHint) : (c->wmhints.flags & ~XUrgencyHint);
+	XSetWMHints(dpy, c->win, &c->wmhints);
+	c->ownhints++;
 }
 
 void hideclient(Client* c) {
@@ -2406,10 +3684,63 @@ void freeclient(Client* c) {
 }
 
 #ifndef NODRW
+	/* Drop the least recently drawn icons of which no client is visible
+	 * until the budget holds, they are loaded again once drawn. */
+	void evicticons(void) {
+		Icon* ic, * lru;
+		Monitor* m;
+		Client* c;
+
+		if (iconbytes <= iconbudget)
+			return;
+		for (ic = icons; ic; ic = ic->next)
+			ic->shown = false;
+		for (m = mons; m; m = m->next)
+			for (c = m->clients; c; c = c->next)
+				if (c->icon && ISVISIBLE(c))
+					c->icon->shown = true;
+		while (iconbytes > iconbudget) {
+			lru = NULL;
+			for (ic = icons; ic; ic = ic->next)
+				if (!ic->shown && (!lru || ic->drawn < lru->drawn))
+					lru = ic;
+			if (!lru)
+				break;
+			for (m = mons; m; m = m->next) {
+				for (c = m->clients; c; c = c->next) {
+					if (c->icon == lru) {
+						freeicon(c);
+						c->iconstale = true;
+					}
+				}
+			}
+		}
+	}
+
 	void freeicon(Client* c) {
-		if (!c->icon) return;
-		XRenderFreePicture(dpy, c->icon);
-		c->icon = None;
+		Icon** tp;
+		Icon* ic = c->icon;
+
+		if (!ic) return;
+		c->icon = NULL;
+		if (--ic->refs) return;
+		for (tp = &icons; *tp != ic; tp = &(*tp)->next);
+		*tp = ic->next;
+		freepicture(ic->pic);
+		iconbytes -= ic->bytes;
+		free(ic);
+	}
+
+	Icon* geticon(uint64_t hash, unsigned int w, unsigned int h) {
+		Icon* ic;
+
+		for (ic = icons; ic; ic = ic->next) {
+			if (ic->hash == hash && ic->w == w && ic->h == h) {
+				++ic->refs;
+				return ic;
+			}
+		}
+		return NULL;
 	}
 #endif /* NODRW */
 
@@ -2424,13 +3755,15 @@ void unfocus(Client* c, bool setfocus) {
 	XSetWindowBorder(dpy, c->win, scheme[SchemeNorm][ColBorder].pixel);
 	if (setfocus) {
 		XSetInputFocus(dpy, root, RevertToPointerRoot, CurrentTime);
-		XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+		setactive(None);
 	}
 }
 
 void unmanage(Client* c, bool destroyed) {
 	Monitor* m = c->mon;
 	XWindowChanges wc;
+	if (hovered == c)
+		hovered = NULL;
 	detach(c);
 	detachstack(c);
 	if (!destroyed) {
@@ -2445,8 +3778,14 @@ void unmanage(Client* c, bool destroyed) {
 		XSetErrorHandler(xerror);
 		XUngrabServer(dpy);
 	}
+	for (int i = 0; i < nstacking; i++)
+		if (stacking[i] == c->win) {
+			memmove(&stacking[i], &stacking[i + 1], (--nstacking - i) * sizeof(*stacking));
+			ewmhdirty |= EwmhStacking;
+			break;
+		}
 	focus(NULL);
-	updateclientlist();
+	ewmhdirty |= EwmhClientList;
 	arrange(m);
 	if (c == grabbedclient)
 		grabbedclient = NULL;
@@ -2454,6 +3793,41 @@ void unmanage(Client* c, bool destroyed) {
 }
 
 #ifndef NODRW
+	void updateatlas(void) {
+		int x = 0, tw;
+		unsigned int i, s;
+
+		for (i = 0; i < LENGTH(tags); i++) {
+			tagx[i] = x;
+			tagw[i] = MAX((int)TEXTW(tags[i]) + textpad * 2, bh);
+			x += tagw[i];
+		}
+		for (i = 0; i < LENGTH(layouts); i++) {
+			ltx[i] = x;
+			x += bh;
+		}
+		if (atlas)
+			drw_surface_resize(bardrw, atlas, x, 2 * bh);
+		else
+			atlas = drw_surface_create(bardrw, x, 2 * bh);
+		drw_setsurface(bardrw, atlas);
+		for (s = SchemeNorm; s <= SchemeSel; s++) {
+			drw_setscheme(bardrw, scheme[s]);
+			for (i = 0; i < LENGTH(tags); i++) {
+				tw = TEXTW(tags[i]);
+				drw_text(bardrw, tagx[i], s * bh, tagw[i], bh, (tagw[i] - tw) / 2, tags[i], false);
+			}
+		}
+		drw_setscheme(bardrw, scheme[SchemeNorm]);
+		for (i = 0; i < LENGTH(layouts); i++) {
+			tw = TEXTW(layouts[i].symbol);
+			drw_text(bardrw, ltx[i], 0, bh, bh, (bh - tw) / 2, layouts[i].symbol, false);
+		}
+		/* cells may have moved, nothing retained can be trusted */
+		for (unsigned int i = 0; i < nbarctxs; i++)
+			barctxs[i].nsegs = 0;
+	}
+
 	void updatebars(void) {
 		Monitor* m;
 		XSetWindowAttributes wa = {
@@ -2473,8 +3847,14 @@ void unmanage(Client* c, bool destroyed) {
 			XDefineCursor(dpy, m->barwin, cursor[CurNormal]);
 			XMapRaised(dpy, m->barwin);
 			XSetClassHint(dpy, m->barwin, &ch);
+			barsync = true;
 		}
 	}
+
+	void resizebar(Monitor* m) {
+		/* the bar thread resizes its surface when the next frame says so */
+		XMoveResizeWindow(dpy, m->barwin, m->bx, m->by, m->bw, m->bh);
+	}
 #endif /* NODRW */
 
 void updatebarpos(Monitor* m) {
@@ -2507,21 +3887,163 @@ void updatebarpos(Monitor* m) {
 	#endif /* NODRW */
 }
 
+void updateclass(Client* c) {
+	XClassHint ch = { NULL, NULL };
+
+	XGetClassHint(dpy, c->win, &ch);
+	setclass(c, ch.res_name, ch.res_class);
+	if (ch.res_class)
+		XFree(ch.res_class);
+	if (ch.res_name)
+		XFree(ch.res_name);
+}
+
+void setclass(Client* c, const char* instance, const char* class) {
+	strncpy(c->class, class ? class : broken, sizeof c->class - 1);
+	strncpy(c->instance, instance ? instance : broken, sizeof c->instance - 1);
+	#ifndef NODRW
+		c->classhash = fnv1a(c->instance, strlen(c->instance) + 1, fnv1a(c->class, strlen(c->class) + 1, FNV1A_INIT));
+	#endif /* NODRW */
+}
+
 void updateclientlist(void) {
 	Client* c;
 	Monitor* m;
+	Window* wins;
+	int n = 0;
 
-	XDeleteProperty(dpy, root, netatom[NetClientList]);
 	for (m = mons; m; m = m->next)
 		for (c = m->clients; c; c = c->next)
-			XChangeProperty(dpy, root, netatom[NetClientList],
-				XA_WINDOW, 32, PropModeAppend,
-				(unsigned char*)&(c->win), true);
+			++n;
+	/* one write for the whole list */
+	wins = ecalloc(n + 1, sizeof(Window));
+	n = 0;
+	for (m = mons; m; m = m->next)
+		for (c = m->clients; c; c = c->next)
+			wins[n++] = c->win;
+	XChangeProperty(dpy, root, netatom[NetClientList], XA_WINDOW, 32,
+		PropModeReplace, (unsigned char*)wins, n);
+	free(wins);
+}
+
+/* one PropModeReplace per changed property, however often it changed */
+void publishewmh(void) {
+	if (ewmhdirty & EwmhClientList)
+		updateclientlist();
+	if (ewmhdirty & EwmhStacking)
+		XChangeProperty(dpy, root, netatom[NetClientListStacking], XA_WINDOW, 32,
+			PropModeReplace, (unsigned char*)stacking, nstacking);
+	if (ewmhdirty & EwmhActive) {
+		if (activewin)
+			XChangeProperty(dpy, root, netatom[NetActiveWindow], XA_WINDOW, 32,
+				PropModeReplace, (unsigned char*)&activewin, 1);
+		else
+			XDeleteProperty(dpy, root, netatom[NetActiveWindow]);
+	}
+	if (ewmhdirty & EwmhState)
+		for (Monitor* m = mons; m; m = m->next)
+			for (Client* c = m->clients; c; c = c->next)
+				if (c->statedirty) {
+					bool fs = c->position == PositionFullscreen;
+					XChangeProperty(dpy, c->win, netatom[NetWMState], XA_ATOM, 32,
+						PropModeReplace, (unsigned char*)&netatom[NetWMFullscreen], fs);
+					c->statedirty = false;
+				}
+	ewmhdirty = 0;
+}
+
+void setactive(Window w) {
+	if (activewin == w)
+		return;
+	activewin = w;
+	ewmhdirty |= EwmhActive;
 }
 
 int updategeom(void) {
 	bool dirty = false;
 
+	#ifdef XRANDR
+		int nn;
+		XRRMonitorInfo* info = userandr ? XRRGetMonitors(dpy, root, true, &nn) : NULL;
+		if (info && nn <= 0) { /* everything off, keep what there is */
+			XRRFreeMonitors(info);
+			info = NULL;
+		}
+		if (info) {
+			Monitor* m, * next, * keep = NULL;
+			Client* c;
+			bool* found = ecalloc(nn, sizeof(bool));
+			int i, j;
+
+			/* mirrored outputs are one monitor, as for Xinerama only
+			 * unique geometries count */
+			for (i = 1; i < nn; i++)
+				for (j = 0; j < i && !found[i]; j++)
+					found[i] = !found[j] && info[j].x == info[i].x && info[j].y == info[i].y
+						&& info[j].width == info[i].width && info[j].height == info[i].height;
+			/* monitors are the same monitor as long as their output is */
+			for (m = mons; m; m = m->next) {
+				for (i = 0; i < nn && (found[i] || info[i].name != m->output); i++);
+				if (i == nn) {
+					m->output = None; /* gone */
+					continue;
+				}
+				found[i] = true;
+				if (!keep)
+					keep = m;
+				if (info[i].x != m->mx || info[i].y != m->my
+					|| info[i].width != m->mw || info[i].height != m->mh)
+				{
+					dirty = m->changed = true;
+					m->mx = m->wx = info[i].x;
+					m->my = m->wy = info[i].y;
+					m->mw = m->ww = info[i].width;
+					m->mh = m->wh = info[i].height;
+					updatebarpos(m);
+				}
+			}
+			for (i = 0; i < nn; i++) {
+				if (found[i])
+					continue;
+				for (m = mons; m && m->next; m = m->next);
+				if (m)
+					m = m->next = createmon();
+				else
+					m = mons = createmon();
+				if (!keep)
+					keep = m;
+				dirty = m->changed = true;
+				m->output = info[i].name;
+				m->mx = m->wx = info[i].x;
+				m->my = m->wy = info[i].y;
+				m->mw = m->ww = info[i].width;
+				m->mh = m->wh = info[i].height;
+				updatebarpos(m);
+			}
+			/* clients of removed monitors go to the first that stays */
+			for (m = mons; m; m = next) {
+				next = m->next;
+				if (m->output != None)
+					continue;
+				while ((c = m->clients)) {
+					m->clients = c->next;
+					detachstack(c);
+					c->mon = keep;
+					attach(c);
+					attachstack(c);
+					keep->changed = true;
+				}
+				if (m == selmon)
+					selmon = keep;
+				dirty = true;
+				cleanupmon(m);
+			}
+			for (i = 0, m = mons; m; m = m->next)
+				m->num = i++;
+			free(found);
+			XRRFreeMonitors(info);
+		} else
+	#endif /* XRANDR */
 	#ifdef XINERAMA
 		if (XineramaIsActive(dpy)) {
 			int i, j, n, nn;
@@ -2552,7 +4074,7 @@ int updategeom(void) {
 					|| unique[i].x_org != m->mx || unique[i].y_org != m->my
 					|| unique[i].width != m->mw || unique[i].height != m->mh)
 				{
-					dirty = 1;
+					dirty = m->changed = true;
 					m->num = i;
 					m->mx = m->wx = unique[i].x_org;
 					m->my = m->wy = unique[i].y_org;
@@ -2574,6 +4096,7 @@ int updategeom(void) {
 				if (m == selmon)
 					selmon = mons;
 				cleanupmon(m);
+				mons->changed = true;
 			}
 			free(unique);
 		} else
@@ -2583,7 +4106,7 @@ int updategeom(void) {
 			mons = createmon();
 		mons->mx = mons->my = 0;
 		if (mons->mw != sw || mons->mh != sh) {
-			dirty = true;
+			dirty = mons->changed = true;
 			mons->mw = mons->ww = sw;
 			mons->mh = mons->wh = sh;
 			updatebarpos(mons);
@@ -2610,6 +4133,25 @@ void updatenumlockmask(void) {
 	modifiers[3] = numlockmask | LockMask;
 }
 
+void updateprotocols(Client* c) {
+	int n;
+	Atom* protocols;
+
+	c->protocols = 0;
+	if (!XGetWMProtocols(dpy, c->win, &protocols, &n))
+		return;
+	while (n--)
+		c->protocols |= protocolbit(protocols[n]);
+	XFree(protocols);
+}
+
+unsigned int protocolbit(Atom a) {
+	for (int i = 0; i < WMLast; i++)
+		if (a == wmatom[i])
+			return 1 << i;
+	return 0;
+}
+
 void updatesizehints(Client* c) {
 	long msize;
 	XSizeHints size;
@@ -2617,35 +4159,39 @@ void updatesizehints(Client* c) {
 	if (!XGetWMNormalHints(dpy, c->win, &size, &msize))
 		/* size is uninitialized, ensure that size.flags aren't used */
 		size.flags = PSize;
-	if (size.flags & PBaseSize) {
-		c->basew = size.base_width;
-		c->baseh = size.base_height;
-	} else if (size.flags & PMinSize) {
-		c->basew = size.min_width;
-		c->baseh = size.min_height;
+	setsizehints(c, &size);
+}
+
+void setsizehints(Client* c, const XSizeHints* size) {
+	if (size->flags & PBaseSize) {
+		c->basew = size->base_width;
+		c->baseh = size->base_height;
+	} else if (size->flags & PMinSize) {
+		c->basew = size->min_width;
+		c->baseh = size->min_height;
 	} else
 		c->basew = c->baseh = 0;
-	if (size.flags & PResizeInc) {
-		c->incw = size.width_inc;
-		c->inch = size.height_inc;
+	if (size->flags & PResizeInc) {
+		c->incw = size->width_inc;
+		c->inch = size->height_inc;
 	} else
 		c->incw = c->inch = 0;
-	if (size.flags & PMaxSize) {
-		c->maxw = size.max_width;
-		c->maxh = size.max_height;
+	if (size->flags & PMaxSize) {
+		c->maxw = size->max_width;
+		c->maxh = size->max_height;
 	} else
 		c->maxw = c->maxh = 0;
-	if (size.flags & PMinSize) {
-		c->minw = size.min_width;
-		c->minh = size.min_height;
-	} else if (size.flags & PBaseSize) {
-		c->minw = size.base_width;
-		c->minh = size.base_height;
+	if (size->flags & PMinSize) {
+		c->minw = size->min_width;
+		c->minh = size->min_height;
+	} else if (size->flags & PBaseSize) {
+		c->minw = size->base_width;
+		c->minh = size->base_height;
 	} else
 		c->minw = c->minh = 0;
-	if (size.flags & PAspect) {
-		c->mina = (float)size.min_aspect.y / size.min_aspect.x;
-		c->maxa = (float)size.max_aspect.x / size.max_aspect.y;
+	if (size->flags & PAspect) {
+		c->mina = (float)size->min_aspect.y / size->min_aspect.x;
+		c->maxa = (float)size->max_aspect.x / size->max_aspect.y;
 	} else
 		c->maxa = c->mina = 0.0;
 	c->isunresizeable = (c->maxw && c->maxh && c->maxw == c->minw && c->maxh == c->minh);
@@ -2656,56 +4202,93 @@ void updatesizehints(Client* c) {
 	void updatestatus(void) {
 		if (!gettextprop(root, XA_WM_NAME, stext, sizeof(stext)))
 			strcpy(stext, "dwm-" VERSION);
-		drawbar(selmon);
+		drawbars();
 	}
 #endif /* NODRW */
 
-void updatetitle(Client* c) {
-	if (!gettextprop(c->win, netatom[NetWMName], c->name, sizeof c->name))
-		gettextprop(c->win, XA_WM_NAME, c->name, sizeof c->name);
-	if (c->name[0] == '\0') /* hack to mark broken clients */
-		strcpy(c->name, broken);
+/* false when the title did not change, as for most updates from
+ * terminals and browsers */
+bool updatetitle(Client* c) {
+	char name[sizeof c->name];
+
+	name[0] = '\0';
+	if (!(c->hasnetname = getutf8prop(c->win, netatom[NetWMName], name, sizeof name)))
+		gettextprop(c->win, XA_WM_NAME, name, sizeof name);
+	if (name[0] == '\0') /* hack to mark broken clients */
+		strcpy(name, broken);
+	titlestats.updates++;
+	if (!strcmp(name, c->name)) {
+		titlestats.unchanged++;
+		return false;
+	}
+	strcpy(c->name, name);
+	return true;
 }
 
 #ifndef NODRW
-	void updateicon(Client* c) {
+	/* n CARD32 items of _NET_WM_ICON from offset o, NULL unless all of them
+	 * are there, left receives the number of items after them */
+	long* iconprop(Display* xdpy, Window win, long o, long n, unsigned long* left) {
 		int format;
-		unsigned long n, extra;
+		unsigned long got;
 		long* p = NULL;
-		long* bstp = NULL;
-		unsigned int w, h, sz;
 		Atom real;
 
-		freeicon(c);
-		c->icon = None;
-
-		if (XGetWindowProperty(dpy, c->win, netatom[NetWMIcon], 0L, LONG_MAX, false, AnyPropertyType,
-			&real, &format, &n, &extra, (unsigned char**)&p) != Success)
-			return;
-		if (n == 0 || format != 32) { XFree(p); return; }
+		if (XGetWindowProperty(xdpy, win, netatom[NetWMIcon], o, n, false, AnyPropertyType,
+			&real, &format, &got, left, (unsigned char**)&p) != Success)
+			return NULL;
+		if (format != 32 || got != (unsigned long)n) {
+			XFree(p);
+			return NULL;
+		}
+		*left /= 4;
+		return p;
+	}
 
-		{
-			long* i;
-			const long* end = p + n;
-			unsigned int bstd = UINT32_MAX, d, m;
-			for (i = p; i < end - 1; i += sz) {
-				if ((w = *i++) >= 16384 || (h = *i++) >= 16384) { XFree(p); return; }
-				if ((sz = w * h) > end - i) break;
-				if ((m = w > h ? w : h) >= ICONSIZE && (d = m - ICONSIZE) < bstd) { bstd = d; bstp = i; }
-			}
-			if (!bstp) {
-				for (i = p; i < end - 1; i += sz) {
-					if ((w = *i++) >= 16384 || (h = *i++) >= 16384) { XFree(p); return; }
-					if ((sz = w * h) > end - i) break;
-					if ((d = ICONSIZE - (w > h ? w : h)) < bstd) { bstd = d; bstp = i; }
+	IconLoad* loadicon(Display* xdpy, Window win, unsigned int seq, uint64_t known) {
+		long* p;
+		long o, bsto = -1;
+		unsigned long left;
+		unsigned int w, h, icw, ich, m, d, bstd = UINT32_MAX, bstw = 0, bsth = 0;
+		unsigned int dim[2];
+		bool above = false;
+		uint64_t hash;
+		IconLoad* l;
+
+		l = ecalloc(1, sizeof(IconLoad));
+		l->win = win;
+		l->seq = seq;
+
+		/* walk the width/height headers only, preferring the smallest entry
+		 * at least ICONSIZE big and else the biggest one below it */
+		for (o = 0; (p = iconprop(xdpy, win, o, 2, &left)); o += 2 + (long)w * h) {
+			w = p[0]; h = p[1];
+			XFree(p);
+			if (w >= 16384 || h >= 16384 || (unsigned long)w * h > left)
+				break;
+			if (w && h) {
+				m = w > h ? w : h;
+				if (m >= ICONSIZE) {
+					d = m - ICONSIZE;
+					if (!above || d < bstd) {
+						above = true;
+						bstd = d; bsto = o; bstw = w; bsth = h;
+					}
+				} else if (!above && (d = ICONSIZE - m) < bstd) {
+					bstd = d; bsto = o; bstw = w; bsth = h;
 				}
 			}
-			if (!bstp) { XFree(p); return; }
+			if ((unsigned long)w * h == left)
+				break;
 		}
+		if (bsto < 0)
+			return l;
 
-		if ((w = *(bstp - 2)) == 0 || (h = *(bstp - 1)) == 0) { XFree(p); return; }
+		/* then transfer the pixels of the chosen one */
+		w = bstw; h = bsth;
+		if (!(p = iconprop(xdpy, win, bsto + 2, (long)w * h, &left)))
+			return l;
 
-		unsigned int icw, ich;
 		if (w <= h) {
 			ich = ICONSIZE; icw = w * ICONSIZE / h;
 			if (icw == 0) icw = 1;
@@ -2713,41 +4296,356 @@ void updatetitle(Client* c) {
 			icw = ICONSIZE; ich = h * ICONSIZE / w;
 			if (ich == 0) ich = 1;
 		}
-		c->icw = icw; c->ich = ich;
 
-		unsigned int i;
-		unsigned int* bstp32 = (unsigned int*)bstp;
-		for (sz = w * h, i = 0; i < sz; ++i) bstp32[i] = prealpha(bstp[i]);
+		/* identical pixels, whether re-set by the same client or shared
+		 * with another one, are uploaded once */
+		dim[0] = w; dim[1] = h;
+		hash = fnv1a(dim, sizeof(dim), FNV1A_INIT);
+		hash = fnv1a(p, (size_t)w * h * sizeof(long), hash);
+		if (hash == known) {
+			l->hash = hash;
+			l->icw = icw; l->ich = ich;
+			XFree(p);
+			return l;
+		}
 
-		c->icon = drw_picture_create_resized(drw, (char*)bstp, w, h, icw, ich);
+		drw_pack_argb(p, w * h);
+		drw_scale_argb((unsigned int*)p, &w, &h, icw, ich);
+
+		free(l);
+		l = ecalloc(1, sizeof(IconLoad) + w * h * sizeof(unsigned int));
+		l->win = win;
+		l->seq = seq;
+		l->hash = hash;
+		l->icw = icw; l->ich = ich;
+		l->w = w; l->h = h;
+		memcpy(l->px, p, w * h * sizeof(unsigned int));
 		XFree(p);
+		return l;
+	}
+
+	void applyicon(Client* c, IconLoad* l) {
+		c->iconpending = false;
+		if (!l->hash) {
+			freeicon(c);
+		} else if (!c->icon || c->icon->hash != l->hash || c->icon->w != l->icw || c->icon->h != l->ich) {
+			freeicon(c);
+			if (!(c->icon = geticon(l->hash, l->icw, l->ich)) && l->w) {
+				c->icon = newicon(l->hash, l->px, l->w, l->h, l->icw, l->ich);
+				setclassicon(c->classhash, l);
+				evicticons();
+			}
+		}
+		free(l);
+	}
+
+	Icon* newicon(uint64_t hash, unsigned int* px, unsigned int w, unsigned int h, unsigned int icw, unsigned int ich) {
+		Icon* ic = ecalloc(1, sizeof(Icon));
+
+		ic->hash = hash;
+		ic->w = icw; ic->h = ich;
+		ic->pic = drw_picture_create_resized(drw, (char*)px, w, h, icw, ich);
+		barsync = true;
+		ic->bytes = (unsigned long)w * h * 4;
+		ic->drawn = drawtick;
+		ic->refs = 1;
+		ic->next = icons;
+		icons = ic;
+		iconbytes += ic->bytes;
+		iconpeak = MAX(iconpeak, iconbytes);
+		return ic;
+	}
+
+	ClassIcon* getclassicon(uint64_t class) {
+		ClassIcon** tp, * ci;
+
+		for (tp = &classicons; (ci = *tp); tp = &ci->next) {
+			if (ci->class == class) {
+				*tp = ci->next;
+				ci->next = classicons;
+				classicons = ci;
+				return ci;
+			}
+		}
+		return NULL;
+	}
+
+	void setclassicon(uint64_t class, const IconLoad* l) {
+		ClassIcon* ci;
+		size_t size = (size_t)l->w * l->h * sizeof(unsigned int);
+
+		if (!(ci = getclassicon(class))) {
+			ci = ecalloc(1, sizeof(ClassIcon));
+			ci->class = class;
+			ci->next = classicons;
+			classicons = ci;
+		} else if (ci->hash == l->hash) {
+			return;
+		}
+		if (ci->owned)
+			free(ci->px);
+		ci->px = ecalloc(1, size);
+		memcpy(ci->px, l->px, size);
+		ci->owned = true;
+		ci->hash = l->hash;
+		ci->icw = l->icw; ci->ich = l->ich;
+		ci->w = l->w; ci->h = l->h;
+	}
+
+	/* $XDG_CACHE_HOME/dwm/name, optionally creating the directories */
+	bool iconcachepath(char* path, size_t size, const char* name, bool create) {
+		const char* xdg = getenv("XDG_CACHE_HOME");
+		const char* home = getenv("HOME");
+		char* p;
+		int n;
+
+		if (xdg && xdg[0])
+			n = snprintf(path, size, "%s/dwm/%s", xdg, name);
+		else if (home)
+			n = snprintf(path, size, "%s/.cache/dwm/%s", home, name);
+		else
+			return false;
+		if (n < 0 || (size_t)n >= size)
+			return false;
+		for (p = strchr(path + 1, '/'); create && p; p = strchr(p + 1, '/')) {
+			*p = '\0';
+			mkdir(path, 0700);
+			*p = '/';
+		}
+		return true;
+	}
+
+	void loadiconcache(void) {
+		char path[PATH_MAX];
+		const IconFileHeader* hdr;
+		const IconFileEntry* e;
+		ClassIcon* ci, ** tp = &classicons;
+		struct stat st;
+		size_t end;
+		int fd;
+
+		if (!iconcachepath(path, sizeof(path), "icons", false) || (fd = open(path, O_RDONLY)) < 0)
+			return;
+		if (fstat(fd, &st) == 0 && (size_t)st.st_size >= sizeof(IconFileHeader)) {
+			iconmap = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+			iconmapsize = st.st_size;
+		}
+		close(fd);
+		if (!iconmap || iconmap == MAP_FAILED) {
+			iconmap = NULL;
+			return;
+		}
+
+		hdr = iconmap;
+		if (memcmp(hdr->magic, "dwmi", 4) || hdr->version != 1 || hdr->iconsize != (uint32_t)ICONSIZE
+			|| hdr->n > ICONFILEMAX || sizeof(*hdr) + hdr->n * sizeof(*e) > iconmapsize)
+			return;
+		for (e = (const IconFileEntry*)(hdr + 1); e < (const IconFileEntry*)(hdr + 1) + hdr->n; e++) {
+			/* pixels must already be scaled, drw scales in place */
+			if (!e->icw || !e->ich || !e->w || !e->h || e->w > e->icw * 2 || e->h > e->ich * 2 || e->offset % 4
+				|| (end = (size_t)e->offset + (size_t)e->w * e->h * 4) > iconmapsize || end < e->offset)
+				continue;
+			ci = ecalloc(1, sizeof(ClassIcon));
+			ci->class = e->class;
+			ci->hash = e->hash;
+			ci->icw = e->icw; ci->ich = e->ich;
+			ci->w = e->w; ci->h = e->h;
+			ci->px = (unsigned int*)((char*)iconmap + e->offset);
+			*tp = ci;
+			tp = &ci->next;
+		}
+	}
+
+	void saveiconcache(void) {
+		char path[PATH_MAX], tmp[PATH_MAX];
+		IconFileHeader hdr = { "dwmi", 1, ICONSIZE, 0 };
+		IconFileEntry e = { 0 };
+		ClassIcon* ci, * next;
+		uint32_t offset, i;
+		FILE* f = NULL;
+
+		if (iconcachepath(path, sizeof(path), "icons", true)
+			&& iconcachepath(tmp, sizeof(tmp), "icons.tmp", false) && (f = fopen(tmp, "wb"))) {
+			for (ci = classicons; ci && hdr.n < ICONFILEMAX; ci = ci->next)
+				hdr.n++;
+			fwrite(&hdr, sizeof(hdr), 1, f);
+			offset = sizeof(hdr) + hdr.n * sizeof(e);
+			for (ci = classicons, i = 0; i < hdr.n; ci = ci->next, i++) {
+				e.class = ci->class;
+				e.hash = ci->hash;
+				e.icw = ci->icw; e.ich = ci->ich;
+				e.w = ci->w; e.h = ci->h;
+				e.offset = offset;
+				offset += ci->w * ci->h * 4;
+				fwrite(&e, sizeof(e), 1, f);
+			}
+			for (ci = classicons, i = 0; i < hdr.n; ci = ci->next, i++)
+				fwrite(ci->px, 4, (size_t)ci->w * ci->h, f);
+			/* replace atomically, the old file is still mapped */
+			if (fclose(f) == 0)
+				rename(tmp, path);
+			else
+				unlink(tmp);
+		}
+
+		for (ci = classicons; ci; ci = next) {
+			next = ci->next;
+			if (ci->owned)
+				free(ci->px);
+			free(ci);
+		}
+		classicons = NULL;
+		if (iconmap)
+			munmap(iconmap, iconmapsize);
+		iconmap = NULL;
+	}
+
+	void updateicon(Client* c) {
+		unsigned int head = jobhead;
+		uint64_t known;
+		ClassIcon* ci;
+
+		/* show the icon this class had last time right away, the real
+		 * one replaces it only if its hash differs */
+		if (!c->icon && (ci = getclassicon(c->classhash))) {
+			if (!(c->icon = geticon(ci->hash, ci->icw, ci->ich)))
+				c->icon = newicon(ci->hash, ci->px, ci->w, ci->h, ci->icw, ci->ich);
+			evicticons();
+		}
+		known = c->icon ? c->icon->hash : 0;
+		++c->iconseq;
+		if (!icondpy || head - __atomic_load_n(&jobtail, __ATOMIC_ACQUIRE) >= ICONQUEUE) {
+			applyicon(c, loadicon(dpy, c->win, c->iconseq, known));
+			return;
+		}
+		iconjobs[head % ICONQUEUE].win = c->win;
+		iconjobs[head % ICONQUEUE].seq = c->iconseq;
+		iconjobs[head % ICONQUEUE].hash = known;
+		__atomic_store_n(&jobhead, head + 1, __ATOMIC_RELEASE);
+		sem_post(&iconjobsem);
+		c->iconpending = true;
+	}
+
+	void drainicons(void) {
+		unsigned int tail;
+		IconLoad* l;
+		Client* c;
+
+		while ((tail = donetail) != __atomic_load_n(&donehead, __ATOMIC_ACQUIRE)) {
+			l = icondone[tail % ICONQUEUE];
+			__atomic_store_n(&donetail, tail + 1, __ATOMIC_RELEASE);
+			sem_post(&iconslotsem);
+			/* the window may be gone or asked for a newer icon meanwhile */
+			if (!(c = wintoclient(l->win)) || c->iconseq != l->seq) {
+				free(l);
+				continue;
+			}
+			applyicon(c, l);
+			drawbars();
+		}
+	}
+
+	void* iconworker(void* arg) {
+		unsigned int tail, head;
+		IconLoad* l;
+		XEvent ev = { .type = ClientMessage };
+
+		(void)arg;
+		ev.xclient.window = wmcheckwin;
+		ev.xclient.message_type = iconready;
+		ev.xclient.format = 32;
+		for (;;) {
+			sem_wait(&iconjobsem);
+			if (__atomic_load_n(&iconquit, __ATOMIC_ACQUIRE))
+				break;
+			tail = jobtail;
+			l = loadicon(icondpy, iconjobs[tail % ICONQUEUE].win, iconjobs[tail % ICONQUEUE].seq, iconjobs[tail % ICONQUEUE].hash);
+			__atomic_store_n(&jobtail, tail + 1, __ATOMIC_RELEASE);
+
+			sem_wait(&iconslotsem);
+			if (__atomic_load_n(&iconquit, __ATOMIC_ACQUIRE)) {
+				free(l);
+				break;
+			}
+			head = donehead;
+			icondone[head % ICONQUEUE] = l;
+			__atomic_store_n(&donehead, head + 1, __ATOMIC_RELEASE);
+			/* wake the main loop, it owns every client and the cache */
+			XSendEvent(icondpy, wmcheckwin, false, NoEventMask, &ev);
+			XFlush(icondpy);
+		}
+		return NULL;
+	}
+
+	void starticonworker(void) {
+		sigset_t all, old;
+
+		/* without a second connection icons load synchronously */
+		if (!(icondpy = XOpenDisplay(NULL)))
+			return;
+		sem_init(&iconjobsem, 0, 0);
+		sem_init(&iconslotsem, 0, ICONQUEUE);
+		/* signals are for the main thread only */
+		sigfillset(&all);
+		pthread_sigmask(SIG_SETMASK, &all, &old);
+		if (pthread_create(&iconthread, NULL, iconworker, NULL)) {
+			XCloseDisplay(icondpy);
+			icondpy = NULL;
+		}
+		pthread_sigmask(SIG_SETMASK, &old, NULL);
+	}
+
+	void stopiconworker(void) {
+		if (!icondpy)
+			return;
+		__atomic_store_n(&iconquit, true, __ATOMIC_RELEASE);
+		sem_post(&iconjobsem);
+		sem_post(&iconslotsem);
+		pthread_join(iconthread, NULL);
+		while (donetail != donehead)
+			free(icondone[donetail++ % ICONQUEUE]);
+		sem_destroy(&iconjobsem);
+		sem_destroy(&iconslotsem);
+		XCloseDisplay(icondpy);
+		icondpy = NULL;
 	}
 #endif /* NODRW */
 
 void updatewindowtype(Client* c) {
-	if (getatomprop(c, netatom[NetWMState]) == netatom[NetWMFullscreen]) {
+	if (c->winstate == netatom[NetWMFullscreen]) {
 		setposition(c, PositionFullscreen, false);
 		return;
 	}
-	if (getatomprop(c, netatom[NetWMWindowType]) == netatom[NetWMWindowTypeDialog]) {
+	if (c->wintype == netatom[NetWMWindowTypeDialog]) {
 		setposition(c, PositionNone, false);
 	}
 }
 
 void updatewmhints(Client* c) {
-	XWMHints* wmh;
-	if ((wmh = XGetWMHints(dpy, c->win))) {
-		if (c == selmon->sel && wmh->flags & XUrgencyHint) {
-			wmh->flags &= ~XUrgencyHint;
-			XSetWMHints(dpy, c->win, wmh);
-		} else
-			c->isurgent = (bool)(wmh->flags & XUrgencyHint);
-		if (wmh->flags & InputHint)
-			c->neverfocus = (bool)(!wmh->input);
-		else
-			c->neverfocus = false;
+	XWMHints* wmh = XGetWMHints(dpy, c->win);
+	setwmhints(c, wmh);
+	if (wmh)
 		XFree(wmh);
+}
+
+void setwmhints(Client* c, const XWMHints* wmh) {
+	if (!(c->haswmhints = wmh != NULL)) {
+		/* no hints, ICCCM defaults */
+		c->isurgent = false;
+		c->neverfocus = false;
+		return;
 	}
+	c->wmhints = *wmh;
+	if (c == selmon->sel && c->wmhints.flags & XUrgencyHint) {
+		c->wmhints.flags &= ~XUrgencyHint;
+		XSetWMHints(dpy, c->win, &c->wmhints);
+		c->ownhints++;
+	} else
+		c->isurgent = (bool)(c->wmhints.flags & XUrgencyHint);
+	if (c->wmhints.flags & InputHint)
+		c->neverfocus = (bool)(!c->wmhints.input);
+	else
+		c->neverfocus = false;
 }
 
 Client* wintoclient(Window w) {
@@ -2781,6 +4679,14 @@ int xerror(Display* dpy, XErrorEvent* ee) {
 	/* There's no way to check accesses to destroyed windows, thus those cases are
 	* ignored (especially on UnmapNotify's). Other types of errors call Xlibs
 	* default error handler, which may call exit. */
+	#ifndef NODRW
+		/* the icon worker copes with failed fetches, the bar thread
+		 * redraws what failed */
+		if (ee->display == bardpy)
+			barerror = true;
+		if (ee->display == icondpy || ee->display == bardpy)
+			return 0;
+	#endif /* NODRW */
 	if (ee->error_code == BadWindow
 		|| (ee->request_code == X_SetInputFocus && ee->error_code == BadMatch)
 		|| (ee->request_code == X_PolyText8 && ee->error_code == BadDrawable)
@@ -2846,6 +4752,7 @@ void xinitvisual(void) {
 }
 
 int main(int argc, char* argv[]) {
+	clock_gettime(CLOCK_MONOTONIC, &tracestart);
 	char* envThemeColor = getenv("THEME_COLOR");
 	if (envThemeColor)
 	{
@@ -2873,23 +4780,39 @@ int main(int argc, char* argv[]) {
 			colors[SchemeSel][ColFg] = argv[++i];
 		else if (!strcmp(argv[i], "-v"))
 			die("dwm-" VERSION);
+		else if (!strcmp(argv[i], "-T"))
+			trace = true;
 		else
-			die("usage: dwm [-v] [-fn font] [-a alpha 0-255]\n" \
+			die("usage: dwm [-v] [-T] [-fn font] [-a alpha 0-255]\n" \
 				"           [-bg color] [-fg color] [-txt color]");
 	}
 
+	#ifndef NODRW
+		if (!XInitThreads())
+			die("dwm: no thread support in xlib");
+	#endif /* NODRW */
 	if (!setlocale(LC_CTYPE, "") || !XSupportsLocale())
 		fputs("warning: no locale support\n", stderr);
 	if (!(dpy = XOpenDisplay(NULL)))
 		die("dwm: cannot open display");
+	tracephase("display");
 	checkotherwm();
+	tracephase("otherwm");
 	autostartexec();
+	tracephase("autostart");
 	setup();
 	#if defined(__OpenBSD__) && defined(BSDEnablePledge)
-		if (pledge("stdio rpath proc exec", NULL) == -1)
-			die("pledge");
+		#ifdef NODRW
+			if (pledge("stdio rpath proc exec", NULL) == -1)
+				die("pledge");
+		#else
+			/* wpath cpath for the icon cache, written on exit */
+			if (pledge("stdio rpath wpath cpath proc exec", NULL) == -1)
+				die("pledge");
+		#endif /* NODRW */
 	#endif /* __OpenBSD__ */
 	scan();
+	tracephase("scan");
 	run();
 	cleanup();
 	XCloseDisplay(dpy);
@@ -28,3 +28,18 @@ void* ecalloc(size_t nmemb, size_t size) {
 		die("calloc:");
 	return p;
 }
+
+void* erealloc(void *p, size_t size) {
+	if (!(p = realloc(p, size)))
+		die("realloc:");
+	return p;
+}
+
+/* 64-bit FNV-1a, chain calls by passing the previous result as hash */
+uint64_t fnv1a(const void *data, size_t len, uint64_t hash) {
+	const unsigned char *p = data;
+
+	while (len--)
+		hash = (hash ^ *p++) * 0x100000001b3ULL;
+	return hash;
+}
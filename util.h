@@ -3,6 +3,7 @@
 #include <stdio.h>
 #include <stdlib.h>
 #include <stdbool.h>
+#include <stdint.h>
 #include <string.h>
 #ifdef Bool
 	#undef Bool
@@ -22,5 +23,9 @@
 #endif /* SWAP */
 #define LENGTH(X)               ((int)(sizeof(X) / sizeof(*X)))
 
+#define FNV1A_INIT              0xcbf29ce484222325ULL
+
 void die(const char *fmt, ...);
 void *ecalloc(size_t nmemb, size_t size);
+void *erealloc(void *p, size_t size);
+uint64_t fnv1a(const void *data, size_t len, uint64_t hash);